@@ -0,0 +1,125 @@
+/************************************************************
+Copyright (C) 2009 Jens M. Schmidt
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+or 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+************************************************************/
+
+#pragma once
+
+// precomputed reductions of the payloads over the stabbing set
+//
+// the stabbing set only changes where an interval starts or just after one
+// ends, so the reduction is constant on at most 2n+1 runs of positions. the
+// runs are found by sweeping the start and end orders while a segment tree
+// over the nodes holds the payload of every active node, which works for any
+// monoid, not just invertible ones like sum. a query is one binary search.
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include "mmintervalstab.hpp"
+
+namespace intervalstab {
+
+// a monoid provides value_type, identity() and an associative combine(x, y)
+
+template <typename T>
+struct sum_monoid {
+    typedef T value_type;
+    static T identity(void) { return T(); }
+    static T combine(const T& x, const T& y) { return x + y; }
+};
+
+template <typename T>
+struct min_monoid {
+    typedef T value_type;
+    static T identity(void) { return std::numeric_limits<T>::max(); }
+    static T combine(const T& x, const T& y) { return std::min(x, y); }
+};
+
+template <typename T>
+struct max_monoid {
+    typedef T value_type;
+    static T identity(void) { return std::numeric_limits<T>::lowest(); }
+    static T combine(const T& x, const T& y) { return std::max(x, y); }
+};
+
+template <typename Monoid>
+class stabbing_aggregate {
+public:
+    typedef typename Monoid::value_type value_type;
+
+private:
+    std::vector<uint64_t> starts; // run i covers [starts[i], starts[i+1])
+    std::vector<value_type> values;
+
+public:
+    /// sweep an indexed db, reducing the payloads of the intervals stabbed at every position
+    /// a node standing for collapsed duplicates contributes each of their payloads
+    template <typename Index>
+    stabbing_aggregate(Index& db) {
+        const uint64_t n = db.n;
+        const auto& e = db.end_order();
+        // bottom-up segment tree over node ids, inactive leaves hold the identity
+        uint64_t leaves = 1;
+        while (leaves < n) leaves *= 2;
+        std::vector<value_type> tree(2*leaves, Monoid::identity());
+        auto set = [&](uint64_t i, const value_type& v) {
+            i += leaves;
+            tree[i] = v;
+            for (i /= 2; i > 0; i /= 2) {
+                tree[i] = Monoid::combine(tree[2*i], tree[2*i+1]);
+            }
+        };
+        starts.push_back(1);
+        values.push_back(Monoid::identity());
+        uint64_t s = 0, t = 0;
+        while (s < n || t < n) {
+            // the next position where the stabbing set changes
+            uint64_t p = std::numeric_limits<uint64_t>::max();
+            if (s < n) p = db.a[s].l;
+            if (t < n) p = std::min(p, e[t]->r + 1);
+            for ( ; s < n && db.a[s].l == p; ++s) {
+                value_type v = Monoid::identity();
+                auto run = db.payloads(&db.a[s]);
+                for (auto x = run.first; x != run.second; ++x) v = Monoid::combine(v, *x);
+                set(s, v);
+            }
+            for ( ; t < n && e[t]->r + 1 == p; ++t) {
+                set(db.node_id(e[t]), Monoid::identity());
+            }
+            if (starts.back() == p) {
+                values.back() = tree[1];
+            } else {
+                starts.push_back(p);
+                values.push_back(tree[1]);
+            }
+        }
+    }
+
+    /// the reduction over the intervals stabbed at q, the identity if there are none
+    value_type aggregate(const uint64_t& q) const {
+        auto it = std::upper_bound(starts.begin(), starts.end(), q);
+        if (it == starts.begin()) return Monoid::identity();
+        return values[it - starts.begin() - 1];
+    }
+
+    /// the number of runs the domain was cut into
+    uint64_t size(void) const {
+        return starts.size();
+    }
+};
+
+}
@@ -0,0 +1,399 @@
+/************************************************************
+Copyright (C) 2009 Jens M. Schmidt
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+or 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+************************************************************/
+
+#pragma once
+
+// block-compressed archives of a built index
+//
+// an archive is one file holding the forest and the payloads of an index in
+// a form meant to sit on disk cold. nodes are cut into blocks, by default of
+// 128: within a block starts are delta coded in sorted order, and ends and
+// links are varints relative to the node, which are small because links
+// mostly point nearby. stop is kept as its runs, delta coded in blocks of
+// the same size with an index of each block's first position. payloads are
+// stored as they are.
+//
+// an archived_index maps the file read only and answers queries with the
+// stabbing traversal over node ids, decoding blocks into a small cache as it
+// reaches them, so a query pays for a few block decodes in exchange for a
+// footprint several times smaller than the node and stop arrays.
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <fstream>
+#include <cstring>
+#include <cerrno>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <atomic>
+#include <unordered_map>
+#include "mmintervalstab.hpp"
+
+namespace intervalstab {
+
+const uint64_t archive_none = std::numeric_limits<uint64_t>::max(); // no such link
+const uint64_t archive_root = archive_none - 1; // the parent of a root
+
+inline void put_varint(std::string& out, uint64_t x) {
+    while (x >= 0x80) {
+        out.push_back((char)(x | 0x80));
+        x >>= 7;
+    }
+    out.push_back((char)x);
+}
+
+inline uint64_t get_varint(const uint8_t*& p) {
+    uint64_t x = 0;
+    for (int shift = 0; ; shift += 7) {
+        uint8_t b = *p++;
+        x |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) return x;
+    }
+}
+
+inline uint64_t zigzag(const int64_t& x) {
+    return ((uint64_t)x << 1) ^ (uint64_t)(x >> 63);
+}
+
+inline int64_t unzigzag(const uint64_t& x) {
+    return (int64_t)(x >> 1) ^ -(int64_t)(x & 1);
+}
+
+// the fixed part at the start of an archive, section offsets in bytes from the start of the file
+struct archive_header {
+    char magic[8] = { 'I', 'S', 'T', 'A', 'B', 'A', 'R', 'C' };
+    uint64_t version = 1;
+    uint64_t block_size = 128;
+    uint64_t value_size = 0; // sizeof the payload type
+    uint64_t n = 0;
+    uint64_t n_records = 0;
+    uint64_t bigN = 0;
+    uint64_t collapsed = 0;
+    uint64_t run_count = 0;
+    uint64_t node_index = 0; // byte offset of each node block in node_data
+    uint64_t node_data = 0;
+    uint64_t run_index = 0; // first position and byte offset of each run block
+    uint64_t run_data = 0;
+    uint64_t values = 0;
+    uint64_t payload_offsets = 0; // if collapsed
+    uint64_t file_size = 0;
+};
+
+struct archive_run_block {
+    uint64_t first = 0;
+    uint64_t offset = 0;
+};
+
+// a node as decoded from an archive, links as node ids
+struct archived_node {
+    uint64_t id = archive_none;
+    uint64_t l = 0;
+    uint64_t r = 0;
+    uint64_t parent = archive_none; // archive_root for roots, none off group heads
+    uint64_t leftsibling = archive_none;
+    uint64_t rightchild = archive_none;
+    uint64_t smaller = archive_none;
+};
+
+/// write the forest and payloads of an indexed db to an archive file, returning its size in bytes
+/// the db must have a forest, so the full-stop or stop-runs backend
+template <typename T, typename Storage>
+uint64_t write_archive(const faststabbing<T, Storage>& db, const std::string& fname,
+                       const uint64_t& block_size = 128) {
+    static_assert(std::is_trivially_copyable<T>::value, "archived payloads are stored as raw bytes");
+    if (db.backend() == BACKEND_SORTED) {
+        throw std::invalid_argument(fname + ": only an index with a forest can be archived");
+    }
+    std::ofstream out(fname.c_str(), std::ios::binary | std::ios::trunc);
+    if (out.fail()) {
+        throw std::ios_base::failure(fname + ": " + std::strerror(errno));
+    }
+    archive_header h;
+    h.block_size = std::max((uint64_t)1, block_size);
+    h.value_size = sizeof(T);
+    h.n = db.n;
+    h.n_records = db.size();
+    h.bigN = db.bigN;
+    h.collapsed = !db.payload_offsets.empty();
+    uint64_t at = 0;
+    auto write = [&out, &at](const void* p, const uint64_t& count) {
+        out.write((const char*)p, count);
+        at += count;
+    };
+    auto align = [&write, &at](void) {
+        static const char zeros[8] = { 0 };
+        if (at % 8) write(zeros, 8 - at % 8);
+    };
+    write(&h, sizeof(h));
+    auto id = [&db](const interval_node<T>* x) { return db.node_id(x); };
+    // nodes
+    std::vector<uint64_t> node_index;
+    h.node_data = at;
+    std::string block;
+    for (uint64_t b = 0; b < db.n; b += h.block_size) {
+        block.clear();
+        for (uint64_t i = b; i < std::min(db.n, b + h.block_size); ++i) {
+            auto& x = db.a[i];
+            put_varint(block, i == b ? x.l : x.l - db.a[i-1].l);
+            put_varint(block, (x.r - x.l) << 1 | (x.smaller != nullptr));
+            put_varint(block, x.parent == nullptr ? 0 : x.parent == &db.dummy ? 1 : i - id(x.parent) + 1);
+            put_varint(block, x.leftsibling == nullptr ? 0 : zigzag((int64_t)id(x.leftsibling) - (int64_t)i) + 1);
+            put_varint(block, x.rightchild == nullptr ? 0 : id(x.rightchild) - i);
+        }
+        node_index.push_back(at - h.node_data);
+        write(block.data(), block.size());
+    }
+    align();
+    h.node_index = at;
+    write(node_index.data(), node_index.size() * sizeof(uint64_t));
+    // stop runs
+    std::vector<archive_run_block> run_index;
+    h.run_data = at;
+    block.clear();
+    uint64_t previous = 0;
+    db.for_each_stop_run([&](const uint64_t& from, const uint64_t&, const interval_node<T>* x) {
+            if (h.run_count % h.block_size == 0) {
+                write(block.data(), block.size());
+                block.clear();
+                run_index.push_back(archive_run_block());
+                run_index.back().first = from;
+                run_index.back().offset = at - h.run_data;
+                previous = from;
+            }
+            put_varint(block, from - previous);
+            put_varint(block, x ? id(x) + 1 : 0);
+            previous = from;
+            ++h.run_count;
+        });
+    write(block.data(), block.size());
+    align();
+    h.run_index = at;
+    write(run_index.data(), run_index.size() * sizeof(archive_run_block));
+    // payloads
+    align();
+    h.values = at;
+    write(db.values.data(), db.values.size() * sizeof(T));
+    align();
+    h.payload_offsets = at;
+    write(db.payload_offsets.data(), db.payload_offsets.size() * sizeof(uint64_t));
+    h.file_size = at;
+    out.seekp(0);
+    out.write((const char*)&h, sizeof(h));
+    out.close();
+    if (out.fail()) {
+        throw std::ios_base::failure(fname + ": " + std::strerror(errno));
+    }
+    return h.file_size;
+}
+
+template <typename T>
+class archived_index {
+private:
+    struct decoded_block {
+        uint64_t block = archive_none;
+        std::vector<archived_node> nodes;
+    };
+
+    mmappable_vector<char> file;
+    archive_header h;
+    const uint64_t* node_index = nullptr;
+    const uint8_t* node_data = nullptr;
+    const archive_run_block* run_index = nullptr;
+    const uint8_t* run_data = nullptr;
+    uint64_t run_blocks = 0;
+    const T* values = nullptr;
+    const uint64_t* payload_offsets = nullptr;
+    uint64_t cache_blocks = 64;
+    uint64_t serial = 0; // tells this archive's caches apart from those of any archive before it
+
+    typedef std::vector<decoded_block> block_cache; // direct mapped
+
+    static std::atomic<uint64_t>& next_serial(void) {
+        static std::atomic<uint64_t> serial(0);
+        return serial;
+    }
+
+    // the calling thread's cache for this archive, whatever started the thread
+    static std::unordered_map<uint64_t, block_cache>& thread_caches(void) {
+        thread_local std::unordered_map<uint64_t, block_cache> caches;
+        return caches;
+    }
+
+    block_cache& cache(void) const {
+        block_cache& c = thread_caches()[serial];
+        if (c.empty()) c.resize(cache_blocks);
+        return c;
+    }
+
+    const archived_node& node_in(block_cache& c, const uint64_t& i) const {
+        uint64_t b = i / h.block_size;
+        decoded_block& d = c[b % c.size()];
+        if (d.block != b) decode(b, d);
+        return d.nodes[i - b * h.block_size];
+    }
+
+    void decode(const uint64_t& b, decoded_block& d) const {
+        d.block = b;
+        uint64_t first = b * h.block_size;
+        uint64_t count = std::min(h.block_size, h.n - first);
+        d.nodes.resize(count);
+        const uint8_t* p = node_data + node_index[b];
+        for (uint64_t k = 0; k < count; ++k) {
+            auto& x = d.nodes[k];
+            uint64_t i = first + k;
+            x.id = i;
+            x.l = k == 0 ? get_varint(p) : d.nodes[k-1].l + get_varint(p);
+            uint64_t r = get_varint(p);
+            x.r = x.l + (r >> 1);
+            x.smaller = r & 1 ? i + 1 : archive_none;
+            uint64_t parent = get_varint(p);
+            x.parent = parent == 0 ? archive_none : parent == 1 ? archive_root : i - (parent - 1);
+            uint64_t leftsibling = get_varint(p);
+            x.leftsibling = leftsibling == 0 ? archive_none : i + unzigzag(leftsibling - 1);
+            uint64_t rightchild = get_varint(p);
+            x.rightchild = rightchild == 0 ? archive_none : i + rightchild;
+        }
+    }
+
+    // the node id of the stop entry for q, if any
+    uint64_t stop_at(const uint64_t& q) const {
+        if (q > h.bigN || run_blocks == 0 || q < run_index[0].first) return archive_none;
+        uint64_t b = std::upper_bound(run_index, run_index + run_blocks, q,
+                                      [](const uint64_t& p, const archive_run_block& x) {
+                                          return p < x.first; }) - run_index - 1;
+        uint64_t count = std::min(h.block_size, h.run_count - b * h.block_size);
+        const uint8_t* p = run_data + run_index[b].offset;
+        uint64_t from = run_index[b].first;
+        uint64_t found = archive_none;
+        for (uint64_t k = 0; k < count; ++k) {
+            from += get_varint(p);
+            if (from > q) break;
+            uint64_t x = get_varint(p);
+            found = x ? x - 1 : archive_none;
+        }
+        return found;
+    }
+
+public:
+    /// map an archive written by write_archive
+    /// that many decoded blocks are kept per thread, so query() may run from any number of threads
+    archived_index(const std::string& fname, const uint64_t& blocks = 64)
+        : cache_blocks(std::max((uint64_t)1, blocks)), serial(next_serial()++) {
+        std::ifstream in(fname.c_str(), std::ios::binary);
+        if (!in.read((char*)&h, sizeof(h))) {
+            throw std::runtime_error(fname + ": not an archive");
+        }
+        archive_header expected;
+        if (std::memcmp(h.magic, expected.magic, sizeof(h.magic)) || h.version != expected.version) {
+            throw std::runtime_error(fname + ": not an archive of this version");
+        }
+        if (h.value_size != sizeof(T)) {
+            throw std::runtime_error(fname + ": archived payloads are " + std::to_string(h.value_size) + " bytes");
+        }
+        in.close();
+        file.mmap_file(fname.c_str(), READ_ONLY, 0, h.file_size);
+        const char* base = &file[0];
+        node_index = (const uint64_t*)(base + h.node_index);
+        node_data = (const uint8_t*)(base + h.node_data);
+        run_index = (const archive_run_block*)(base + h.run_index);
+        run_data = (const uint8_t*)(base + h.run_data);
+        run_blocks = (h.run_count + h.block_size - 1) / h.block_size;
+        values = (const T*)(base + h.values);
+        payload_offsets = h.collapsed ? (const uint64_t*)(base + h.payload_offsets) : nullptr;
+    }
+
+    /// other threads drop their caches of this archive when they exit
+    ~archived_index(void) {
+        thread_caches().erase(serial);
+        file.munmap_file();
+    }
+
+    archived_index(const archived_index&) = delete;
+    archived_index& operator=(const archived_index&) = delete;
+
+    /// the number of records
+    size_t size(void) const {
+        return h.n_records;
+    }
+
+    uint64_t node_count(void) const {
+        return h.n;
+    }
+
+    uint64_t domain(void) const {
+        return h.bigN;
+    }
+
+    /// the size of the archive file
+    uint64_t bytes(void) const {
+        return h.file_size;
+    }
+
+    /// node id i, decoded through the calling thread's cache
+    /// the reference lasts until the thread decodes another block into the same slot
+    const archived_node& node(const uint64_t& i) {
+        return node_in(cache(), i);
+    }
+
+    /// the payloads of the input intervals node id i stands for, as [first, second)
+    std::pair<const T*, const T*> payloads(const uint64_t& i) const {
+        if (!payload_offsets) return std::make_pair(values + i, values + i + 1);
+        return std::make_pair(values + payload_offsets[i], values + payload_offsets[i+1]);
+    }
+
+    /// call f(x) with a copy of every node stabbed at q, in query order
+    template <typename F>
+    void for_each_stabbed(const uint64_t& q, const F& f) {
+        uint64_t top = stop_at(q);
+        if (top == archive_none) return;
+        block_cache& c = cache();
+        std::deque<uint64_t> process;
+        for (uint64_t t = top; t != archive_root && node_in(c, t).parent != archive_none; t = node_in(c, t).parent) {
+            process.push_front(t);
+        }
+        while (!process.empty()) {
+            archived_node x = node_in(c, process.back());
+            process.pop_back();
+            f(x);
+            for (uint64_t t = x.smaller; t != archive_none; ) {
+                archived_node y = node_in(c, t);
+                if (q > y.r) break;
+                f(y);
+                t = y.smaller;
+            }
+            // go along rightmost path of the left sibling
+            for (uint64_t t = x.leftsibling; t != archive_none; ) {
+                const archived_node& y = node_in(c, t);
+                if (y.r < q) break;
+                process.push_back(t);
+                t = y.rightchild;
+            }
+        }
+    }
+
+    /// the nodes stabbed at q, in query order
+    std::vector<archived_node> query(const uint64_t& q) {
+        std::vector<archived_node> output;
+        for_each_stabbed(q, [&output](const archived_node& x) { output.push_back(x); });
+        return output;
+    }
+};
+
+}
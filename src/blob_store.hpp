@@ -0,0 +1,103 @@
+/************************************************************
+Copyright (C) 2009 Jens M. Schmidt
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+or 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+************************************************************/
+
+#pragma once
+
+// variable-length payloads, such as feature names
+//
+// the bytes of every payload are appended to one blob file and the index
+// carries a fixed-size blob_ref as its payload, so faststabbing<blob_ref>
+// keeps offsets in its payload column and the bytes stay out of the way
+// until a result is printed
+
+#include <string>
+#include <fstream>
+#include <mutex>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include "mmappable_vector.h"
+
+namespace intervalstab {
+
+using namespace mmap_allocator_namespace;
+
+// where one payload lives in the blob file
+struct blob_ref {
+    uint64_t offset = 0;
+    uint64_t length = 0;
+};
+
+class blob_store {
+private:
+    std::string fname;
+    std::ofstream out;
+    std::mutex append_lock;
+    uint64_t bytes_written = 0;
+    mmappable_vector<char> bytes;
+    bool mapped = false;
+
+public:
+    blob_store(const std::string& f)
+        : fname(f) {
+        out.open(fname.c_str(), std::ios::binary | std::ios::trunc);
+        if (out.fail()) {
+            throw std::ios_base::failure(std::strerror(errno));
+        }
+    }
+
+    ~blob_store(void) {
+        if (mapped) bytes.munmap_file();
+        if (out.is_open()) out.close();
+        std::remove(fname.c_str());
+    }
+
+    blob_store(const blob_store&) = delete;
+    blob_store& operator=(const blob_store&) = delete;
+
+    /// append a payload, safe to call from many threads, returning the reference to index
+    blob_ref add(const std::string& s) {
+        std::lock_guard<std::mutex> guard(append_lock);
+        blob_ref ref;
+        ref.offset = bytes_written;
+        ref.length = s.size();
+        out.write(s.data(), s.size());
+        bytes_written += s.size();
+        return ref;
+    }
+
+    /// finish appending and map the blob file for reading
+    void seal(void) {
+        out.close();
+        if (bytes_written) {
+            bytes.mmap_file(fname.c_str(), READ_ONLY, 0, bytes_written);
+            mapped = true;
+        }
+    }
+
+    /// the bytes of a payload, valid after seal()
+    const char* data(const blob_ref& ref) const {
+        return mapped ? &bytes[0] + ref.offset : nullptr;
+    }
+
+    std::string get(const blob_ref& ref) const {
+        return ref.length ? std::string(data(ref), ref.length) : std::string();
+    }
+};
+
+}
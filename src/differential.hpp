@@ -0,0 +1,366 @@
+/************************************************************
+Copyright (C) 2009 Jens M. Schmidt
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+or 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+************************************************************/
+
+#pragma once
+
+// differential testing of a stabbing index against a brute-force sweep
+//
+// the expected depth and an order-independent hash of the stabbed intervals
+// are computed for every position with difference arrays, which is O(n + N)
+// and shares no code with the index, then every position is queried in
+// parallel and compared against them
+
+#include <vector>
+#include <string>
+#include <random>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+#include <omp.h>
+#include "args.hxx"
+
+namespace intervalstab {
+
+namespace differential {
+
+// a test interval, with its position in the generated input as payload
+struct span {
+    uint64_t l = 0;
+    uint64_t r = 0;
+    uint64_t id = 0;
+};
+
+inline uint64_t mix(uint64_t x) {
+    // splitmix64 finalizer
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+inline uint64_t hash(const uint64_t& l, const uint64_t& r, const uint64_t& id) {
+    return mix(mix(mix(l) ^ r) ^ id);
+}
+
+// the input shapes we test, each chosen to stress a different part of the build
+enum shape {
+    UNIFORM,    // uniform starts, uniform lengths
+    DUPLICATES, // few distinct intervals, each repeated many times
+    NESTED,     // deep chains of nested intervals sharing starts or ends
+    ZERO_LENGTH, // mostly intervals [x,x]
+    EDGES,      // intervals touching the first and last position of the domain, a few spanning it
+    SHAPE_COUNT
+};
+
+inline const char* shape_name(const shape& s) {
+    switch (s) {
+    case UNIFORM: return "uniform";
+    case DUPLICATES: return "duplicates";
+    case NESTED: return "nested";
+    case ZERO_LENGTH: return "zero-length";
+    case EDGES: return "edges";
+    default: return "unknown";
+    }
+}
+
+// generate n intervals in [1,bigN]
+// blocks of the input are seeded independently so the result does not depend on the thread count
+inline std::vector<span> generate(const shape& s, const uint64_t& n, const uint64_t& bigN,
+                                  const uint64_t& max_length, const uint64_t& seed) {
+    std::vector<span> input(n);
+    const uint64_t block = 1 << 16;
+    const uint64_t pool = std::max((uint64_t)1, n / 64); // distinct intervals in DUPLICATES
+#pragma omp parallel for schedule(dynamic)
+    for (uint64_t b = 0; b < n; b += block) {
+        std::mt19937_64 gen(mix(seed ^ mix(b)));
+        std::uniform_int_distribution<uint64_t> pos(1, bigN);
+        std::uniform_int_distribution<uint64_t> len(0, max_length);
+        for (uint64_t i = b; i < std::min(n, b + block); ++i) {
+            auto& x = input[i];
+            x.id = i;
+            switch (s) {
+            case UNIFORM:
+                x.l = pos(gen);
+                x.r = x.l + len(gen);
+                break;
+            case DUPLICATES: {
+                std::mt19937_64 pick(mix(seed ^ (i % pool)));
+                x.l = pos(pick);
+                x.r = x.l + len(pick);
+                break;
+            }
+            case NESTED: {
+                // chains around a few centers, alternately sharing the start, the end, or neither
+                std::mt19937_64 center(mix(seed ^ (i % 97)));
+                uint64_t c = pos(center);
+                uint64_t k = (i / 97) % (max_length + 1);
+                switch (i % 3) {
+                case 0: x.l = c; x.r = c + k; break;
+                case 1: x.l = c > k ? c - k : 1; x.r = c; break;
+                default: x.l = c > k ? c - k : 1; x.r = c + k; break;
+                }
+                break;
+            }
+            case ZERO_LENGTH:
+                x.l = pos(gen);
+                x.r = gen() % 8 ? x.l : x.l + len(gen);
+                break;
+            case EDGES:
+                switch (i < 4 ? 0 : 1 + gen() % 256) {
+                case 0: x.l = 1; x.r = bigN; break;
+                case 1: x.l = 1; x.r = 1 + len(gen); break;
+                case 2: x.r = bigN; x.l = bigN > max_length ? bigN - len(gen) : 1; break;
+                default: x.l = pos(gen); x.r = x.l + len(gen); break;
+                }
+                break;
+            default:
+                break;
+            }
+            x.r = std::min(x.r, bigN);
+        }
+    }
+    return input;
+}
+
+// the brute-force answer: depth and hash sum of the stabbing set at every position
+struct expectation {
+    uint64_t bigN = 0;
+    std::vector<uint64_t> depth;
+    std::vector<uint64_t> hash_sum;
+};
+
+// if with_ids is false the payload is left out of the hash, for indexes that carry none
+inline expectation expect(const std::vector<span>& input, const uint64_t& bigN, const bool& with_ids) {
+    expectation e;
+    e.bigN = bigN;
+    e.depth.resize(bigN+2, 0);
+    e.hash_sum.resize(bigN+2, 0);
+    // difference arrays, unsigned arithmetic wraps as needed
+    for (auto& x : input) {
+        uint64_t h = hash(x.l, x.r, with_ids ? x.id : 0);
+        ++e.depth[x.l];
+        --e.depth[x.r+1];
+        e.hash_sum[x.l] += h;
+        e.hash_sum[x.r+1] -= h;
+    }
+    for (uint64_t q = 1; q <= bigN+1; ++q) {
+        e.depth[q] += e.depth[q-1];
+        e.hash_sum[q] += e.hash_sum[q-1];
+    }
+    return e;
+}
+
+// the brute-force answer for a join of a with b: the number of overlapping pairs
+// and the sum of mix(x.id) * hash(y.l, y.r, y.id) over them, from prefix sums over the sorted starts and ends of a
+struct join_expectation {
+    uint64_t pairs = 0;
+    uint64_t hash_sum = 0;
+};
+
+inline join_expectation expect_join(const std::vector<span>& a, const std::vector<span>& b) {
+    std::vector<std::pair<uint64_t, uint64_t>> starts, ends;
+    for (auto& x : a) {
+        starts.push_back(std::make_pair(x.l, mix(x.id)));
+        ends.push_back(std::make_pair(x.r, mix(x.id)));
+    }
+    std::sort(starts.begin(), starts.end());
+    std::sort(ends.begin(), ends.end());
+    std::vector<uint64_t> start_ids(a.size()+1, 0), end_ids(a.size()+1, 0);
+    for (uint64_t i = 0; i < a.size(); ++i) {
+        start_ids[i+1] = start_ids[i] + starts[i].second;
+        end_ids[i+1] = end_ids[i] + ends[i].second;
+    }
+    auto position = [](const std::pair<uint64_t, uint64_t>& x, const uint64_t& p) { return x.first < p; };
+    // x overlaps y iff x starts at or before y.r and does not end before y.l
+    uint64_t pairs = 0, hash_sum = 0;
+#pragma omp parallel for reduction(+:pairs,hash_sum)
+    for (uint64_t k = 0; k < b.size(); ++k) {
+        auto& y = b[k];
+        uint64_t s = std::lower_bound(starts.begin(), starts.end(), y.r + 1, position) - starts.begin();
+        uint64_t e = std::lower_bound(ends.begin(), ends.end(), y.l, position) - ends.begin();
+        pairs += s - e;
+        hash_sum += (start_ids[s] - end_ids[e]) * hash(y.l, y.r, y.id);
+    }
+    join_expectation e;
+    e.pairs = pairs;
+    e.hash_sum = hash_sum;
+    return e;
+}
+
+// collects the first few failures from many threads
+class report {
+private:
+    std::atomic<uint64_t> failures;
+    uint64_t max_printed = 10;
+
+public:
+    report(void) : failures(0) { }
+
+    void fail(const std::string& what, const uint64_t& q) {
+        if (failures++ < max_printed) {
+#pragma omp critical (differential_report)
+            std::cerr << "error: " << what << " at " << q << std::endl;
+        }
+    }
+
+    uint64_t failed(void) const {
+        return failures;
+    }
+};
+
+// check a query result for position q against the expectation
+// the result must be exactly the stabbing set, ordered by descending start and then descending end
+// records(x, f) calls f(id) for each input interval that node x stands for
+template <typename Node, typename Records>
+void check(const std::vector<Node*>& output, const uint64_t& q, const expectation& e,
+           const Records& records, report& rep) {
+    uint64_t depth = q <= e.bigN ? e.depth[q] : 0;
+    uint64_t hash_sum = q <= e.bigN ? e.hash_sum[q] : 0;
+    uint64_t count = 0;
+    uint64_t h = 0;
+    for (uint64_t i = 0; i < output.size(); ++i) {
+        auto* x = output[i];
+        if (x->l > q || x->r < q) {
+            rep.fail("query returned [" + std::to_string(x->l) + "," + std::to_string(x->r)
+                     + "] which does not contain the query", q);
+            return;
+        }
+        if (i > 0 && (x->l > output[i-1]->l || x->l == output[i-1]->l && x->r > output[i-1]->r)) {
+            rep.fail("query output out of order", q);
+            return;
+        }
+        records(x, [&](const uint64_t& id) {
+                ++count;
+                h += hash(x->l, x->r, id);
+            });
+    }
+    if (count != depth) {
+        rep.fail("query returned " + std::to_string(count)
+                 + " intervals instead of " + std::to_string(depth), q);
+    } else if (h != hash_sum) {
+        rep.fail("query returned the right number of intervals but the wrong ones", q);
+    }
+}
+
+// check the result of a windowed query against a scan of the input
+// keep(x) says whether an interval, input span or node alike, belongs in the result
+template <typename Node, typename Keep, typename Records>
+void check_window(const std::string& what, const std::vector<Node*>& output, const std::vector<span>& input,
+                  const Keep& keep, const Records& records, const uint64_t& q, report& rep) {
+    uint64_t depth = 0, hash_sum = 0;
+#pragma omp parallel for reduction(+:depth,hash_sum)
+    for (uint64_t i = 0; i < input.size(); ++i) {
+        auto& x = input[i];
+        if (keep(x)) {
+            ++depth;
+            hash_sum += hash(x.l, x.r, x.id);
+        }
+    }
+    uint64_t count = 0, h = 0;
+    for (auto* x : output) {
+        if (!keep(*x)) {
+            rep.fail(what + " returned [" + std::to_string(x->l) + "," + std::to_string(x->r) + "]", q);
+            return;
+        }
+        records(x, [&](const uint64_t& id) {
+                ++count;
+                h += hash(x->l, x->r, id);
+            });
+    }
+    if (count != depth) {
+        rep.fail(what + " returned " + std::to_string(count)
+                 + " intervals instead of " + std::to_string(depth), q);
+    } else if (h != hash_sum) {
+        rep.fail(what + " returned the right number of intervals but the wrong ones", q);
+    }
+}
+
+// run query over every position of the domain and one past it, in parallel
+template <typename Query, typename Records>
+void check_all(const Query& query, const expectation& e, const Records& records, report& rep) {
+#pragma omp parallel for schedule(dynamic, 4096)
+    for (uint64_t q = 1; q <= e.bigN+1; ++q) {
+        check(query(q), q, e, records, rep);
+    }
+}
+
+// the same at count positions spread over the domain and its edges, for pairings too slow to check everywhere
+template <typename Query, typename Records>
+void check_sampled(const Query& query, const expectation& e, const Records& records, report& rep,
+                   const uint64_t& count) {
+#pragma omp parallel for schedule(dynamic, 16)
+    for (uint64_t k = 0; k <= count + 1; ++k) {
+        uint64_t q = k == 0 ? 1 : k > count ? e.bigN+1 : 1 + (k - 1) * e.bigN / count;
+        check(query(q), q, e, records, rep);
+    }
+}
+
+// command line shared by the differential test drivers
+struct options {
+    std::string base = "differential";
+    uint64_t n = 100000;
+    uint64_t bigN = 1000000;
+    uint64_t max_length = 1000;
+    uint64_t seed = 233282;
+    uint64_t rounds = 1;
+    std::string server; // the intervalstab-serve binary, for the serve test
+};
+
+// returns false if the program should exit without testing
+inline bool parse(int argc, char** argv, const std::string& what, options& opts, int& status) {
+    args::ArgumentParser parser(what);
+    args::HelpFlag help(parser, "help", "display this help summary", {'h', "help"});
+    args::ValueFlag<std::string> base(parser, "FILE", "base name for index files", {'T', "test-file"});
+    args::ValueFlag<uint64_t> size(parser, "N", "test this many intervals", {'s', "test-size"});
+    args::ValueFlag<uint64_t> max_val(parser, "N", "generate test data in the range [1,max_value]", {'M', "max-value"});
+    args::ValueFlag<uint64_t> max_length(parser, "N", "the maximum interval length", {'l', "max-length"});
+    args::ValueFlag<uint64_t> threads(parser, "N", "number of threads to use", {'t', "threads"});
+    args::ValueFlag<uint64_t> random_seed(parser, "N", "a random seed for the inputs", {'S', "random-seed"});
+    args::ValueFlag<uint64_t> rounds(parser, "N", "test this many seeds per input shape", {'r', "rounds"});
+    args::ValueFlag<std::string> server(parser, "PATH", "the intervalstab-serve binary, for the serve test", {"server"});
+    status = 0;
+    try {
+        parser.ParseCLI(argc, argv);
+    } catch (args::Help&) {
+        std::cout << parser;
+        return false;
+    } catch (args::ParseError& e) {
+        std::cerr << e.what() << std::endl;
+        std::cerr << parser;
+        status = 1;
+        return false;
+    }
+    if (base) opts.base = args::get(base);
+    if (size) opts.n = args::get(size);
+    if (max_val) opts.bigN = args::get(max_val);
+    if (max_length) opts.max_length = args::get(max_length);
+    if (random_seed) opts.seed = args::get(random_seed);
+    if (rounds) opts.rounds = args::get(rounds);
+    if (server) opts.server = args::get(server);
+    if (threads) omp_set_num_threads(args::get(threads));
+    return true;
+}
+
+inline double seconds_since(const std::chrono::steady_clock::time_point& t) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+}
+
+}
+
+}
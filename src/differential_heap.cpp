@@ -0,0 +1,110 @@
+/************************************************************
+Copyright (C) 2009 Jens M. Schmidt
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+or 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+************************************************************/
+
+// differential test of faststabbing kept entirely in anonymous memory
+
+#include "mmintervalstab.hpp"
+#include "iitii.hpp"
+#include "window.hpp"
+#include "differential.hpp"
+
+using namespace intervalstab;
+using namespace intervalstab::differential;
+
+int main(int argc, char** argv) {
+    options opts;
+    int status = 0;
+    if (!parse(argc, argv, "differential test of the in-memory stabbing index", opts, status)) {
+        return status;
+    }
+    uint64_t failed = 0;
+    for (int s = 0; s < SHAPE_COUNT; ++s) {
+        for (uint64_t round = 0; round < opts.rounds; ++round) {
+            auto start = std::chrono::steady_clock::now();
+            uint64_t seed = mix(opts.seed + round);
+            std::vector<span> input = generate((shape)s, opts.n, opts.bigN, opts.max_length, seed);
+            expectation e = expect(input, opts.bigN, true);
+            report rep;
+            // every backend, whatever the profile would choose
+            for (auto backend : { BACKEND_FULL_STOP, BACKEND_STOP_RUNS, BACKEND_SORTED }) {
+                faststabbing<uint64_t, anonymous_storage> db;
+                db.set_backend(backend);
+#pragma omp parallel for
+                for (uint64_t i = 0; i < input.size(); ++i) {
+                    db.add(interval<uint64_t>(input[i].l, input[i].r, input[i].id));
+                }
+                db.index();
+                auto query = [&db](const uint64_t& q) { return db.query(q); };
+                auto records = [&db](const interval_node<uint64_t>* x, const auto& f) { f(db.value(x)); };
+                if (backend == BACKEND_SORTED && (s == EDGES || s == NESTED)) {
+                    // long intervals make every scan walk most of the nodes, which auto avoids
+                    check_sampled(query, e, records, rep, 1024);
+                } else {
+                    check_all(query, e, records, rep);
+                }
+                for (uint64_t b = 1; b <= opts.bigN; b += opts.bigN / 61 + 1) {
+                    uint64_t last = std::min(opts.bigN, b + opts.max_length / 2);
+                    check_window("enclosing", db.enclosing(b, last), input,
+                                 [&](const auto& x) { return x.l <= b && x.r >= last; },
+                                 [&db](const interval_node<uint64_t>* x, const auto& f) { f(db.value(x)); }, b, rep);
+                }
+            }
+            // a few domain-spanning intervals over sparse data must keep auto off the sorted scan
+            if (s == EDGES) {
+                faststabbing<uint64_t, anonymous_storage> sparse;
+                std::vector<span> few = generate(EDGES, 2000, 2000000, opts.max_length, seed);
+                for (auto& x : few) sparse.add(interval<uint64_t>(x.l, x.r, x.id));
+                sparse.index();
+                if (sparse.backend() == BACKEND_SORTED) {
+                    rep.fail("auto chose the sorted scan with a scan estimate of "
+                             + std::to_string(sparse.dataset().scan_estimate), 0);
+                }
+            }
+            // the implicit tree reports in start order, so put it in the order check expects
+            iitii<uint64_t, anonymous_storage> tree;
+            tree.set_domains(1 + seed % 256);
+            for (auto& x : input) tree.add(interval<uint64_t>(x.l, x.r, x.id));
+            tree.index();
+            check_all([&tree](const uint64_t& q) {
+                    std::vector<iitii_node*> found = tree.query(q);
+                    std::sort(found.begin(), found.end(), [](const iitii_node* x, const iitii_node* y) {
+                            return x->l > y->l || x->l == y->l && x->r > y->r; });
+                    return found;
+                }, e, [&tree](const iitii_node* x, const auto& f) { f(tree.value(x)); }, rep);
+            // the sliding window, fed in start order and half expired, must agree past the expiry point
+            std::sort(input.begin(), input.end(), [](const span& x, const span& y) { return x.l < y.l; });
+            sliding_window<uint64_t> window(opts.bigN / 16 + 1);
+            for (auto& x : input) window.add(interval<uint64_t>(x.l, x.r, x.id));
+            std::vector<span>().swap(input);
+            uint64_t before = opts.bigN / 2;
+            window.expire(before);
+            for (uint64_t q = before; q <= opts.bigN+1; q += 3) {
+                std::vector<interval<uint64_t>> found = window.query(q);
+                std::sort(found.begin(), found.end(), [](const interval<uint64_t>& x, const interval<uint64_t>& y) {
+                        return x.l > y.l || x.l == y.l && x.r > y.r; });
+                std::vector<interval<uint64_t>*> output;
+                for (auto& x : found) output.push_back(&x);
+                check(output, q, e, [](const interval<uint64_t>* x, const auto& f) { f(x->value); }, rep);
+            }
+            std::cerr << "heap\t" << shape_name((shape)s) << "\t" << round << "\t"
+                      << (rep.failed() ? "FAIL" : "ok") << "\t" << seconds_since(start) << "s" << std::endl;
+            failed += rep.failed();
+        }
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,573 @@
+/************************************************************
+Copyright (C) 2009 Jens M. Schmidt
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+or 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+************************************************************/
+
+// differential test of the memory-mapped index in mmintervalstab.hpp
+
+#include <queue>
+#include <thread>
+#include "mmintervalstab.hpp"
+#include "join.hpp"
+#include "aggregate.hpp"
+#include "numa.hpp"
+#include "archive.hpp"
+#include "input.hpp"
+#include "differential.hpp"
+
+using namespace intervalstab;
+using namespace intervalstab::differential;
+
+// how the index under test is built
+enum build_mode {
+    PLAIN,
+    COLLAPSED, // duplicates collapsed into payload runs
+    MERGED,    // two halves indexed separately then merged
+    SORTED,    // added in sorted order and declared sorted
+    BUILD_MODE_COUNT
+};
+
+const char* build_mode_name(const build_mode& m) {
+    switch (m) {
+    case COLLAPSED: return "mm-collapsed";
+    case MERGED: return "mm-merged";
+    case SORTED: return "mm-sorted";
+    default: return "mm";
+    }
+}
+
+// the node links and stop entries of two indexes over the same input, as node ids
+// returns where they first differ, or nothing if they are the same forest
+template <typename X, typename Y>
+std::string forest_difference(X& x, Y& y) {
+    auto id_x = [&x](const interval_node<uint64_t>* p) {
+        return p == nullptr ? -1 : p == &x.dummy ? -2 : (int64_t)x.node_id(p); };
+    auto id_y = [&y](const interval_node<uint64_t>* p) {
+        return p == nullptr ? -1 : p == &y.dummy ? -2 : (int64_t)y.node_id(p); };
+    if (x.n != y.n || x.bigN != y.bigN) return "sizes";
+    if (id_x(x.dummy.rightchild) != id_y(y.dummy.rightchild)) return "last root";
+    for (uint64_t i = 0; i < x.n; ++i) {
+        auto& p = x.a[i];
+        auto& q = y.a[i];
+        if (p.l != q.l || p.r != q.r || id_x(p.parent) != id_y(q.parent)
+            || id_x(p.leftsibling) != id_y(q.leftsibling) || id_x(p.rightchild) != id_y(q.rightchild)
+            || id_x(p.smaller) != id_y(q.smaller)) {
+            return "node " + std::to_string(i);
+        }
+    }
+    for (uint64_t i = 1; i <= x.bigN; ++i) {
+        if (id_x(x.stop[i]) != id_y(y.stop[i])) return "stop " + std::to_string(i);
+    }
+    return std::string();
+}
+
+// past this many intervals or positions, the checks that rescan the whole input for each probe
+// use a few probes, the sequential walks over the domain visit a sample of its positions,
+// and the index is no longer rebuilt twice more to compare sweeps
+const uint64_t brute_force_limit = 1 << 22;
+
+typedef faststabbing<uint64_t> index_type;
+
+// calls f(id) for each input interval node x stands for
+auto records_of(const index_type& db) {
+    return [&db](const interval_node<uint64_t>* x, const auto& f) {
+        auto run = db.payloads(x);
+        for (auto v = run.first; v != run.second; ++v) f(*v);
+    };
+}
+
+void build(index_type& db, const std::vector<span>& input, const build_mode& mode, const options& opts) {
+    if (mode == MERGED) {
+        faststabbing<uint64_t> x(opts.base + ".x");
+        faststabbing<uint64_t> y(opts.base + ".y");
+#pragma omp parallel for
+        for (uint64_t i = 0; i < input.size(); ++i) {
+            (i % 2 ? x : y).add(interval<uint64_t>(input[i].l, input[i].r, input[i].id));
+        }
+        x.index();
+        y.index();
+        db.merge(x, y);
+    } else if (mode == SORTED) {
+        std::vector<span> in_order = input;
+        std::sort(in_order.begin(), in_order.end(), [](const span& x, const span& y) {
+                return x.l < y.l || x.l == y.l && x.r > y.r; });
+        db.set_sorted_input(true);
+        for (auto& x : in_order) {
+            db.add(interval<uint64_t>(x.l, x.r, x.id));
+        }
+        db.index();
+    } else {
+        db.set_collapse_duplicates(mode == COLLAPSED);
+#pragma omp parallel for
+        for (uint64_t i = 0; i < input.size(); ++i) {
+            db.add(interval<uint64_t>(input[i].l, input[i].r, input[i].id));
+        }
+        db.index();
+    }
+}
+
+// a merge only fills an empty index, one that already holds intervals or is indexed must refuse
+void check_merge(const std::vector<span>& input, report& rep) {
+    typedef faststabbing<uint64_t, anonymous_storage> small_index;
+    small_index x, y;
+    uint64_t count = std::min(input.size(), (uint64_t)4096);
+    for (uint64_t i = 0; i < count; ++i) {
+        (i % 2 ? x : y).add(interval<uint64_t>(input[i].l, input[i].r, input[i].id));
+    }
+    x.index();
+    y.index();
+    auto refused = [&](small_index& into) {
+        try {
+            into.merge(x, y);
+        } catch (std::logic_error&) {
+            return true;
+        }
+        return false;
+    };
+    small_index held;
+    held.add(interval<uint64_t>(1, 1, 0));
+    if (!refused(held)) rep.fail("merged into an index holding intervals", 0);
+    held.index();
+    if (held.size() != 1) rep.fail("refused merge changed the receiver", 0);
+    if (!refused(held)) rep.fail("merged into an indexed index", 0);
+    small_index fresh;
+    if (refused(fresh)) rep.fail("refused to merge into an empty index", 0);
+    if (fresh.size() != count) rep.fail("merge lost intervals", 0);
+}
+
+// the chunked sweep must build exactly the forest of the sequential one, however it is cut
+void check_sweep(index_type& db, const std::vector<span>& input, const build_mode& mode,
+                 const uint64_t& seed, report& rep) {
+    if (input.size() > brute_force_limit) return;
+    faststabbing<uint64_t, anonymous_storage> sequential;
+    faststabbing<uint64_t, anonymous_storage> chunked;
+    sequential.set_sweep_chunks(1);
+    chunked.set_sweep_chunks(1 + seed % 1024);
+    for (auto* x : { &sequential, &chunked }) {
+        x->set_backend(BACKEND_FULL_STOP);
+        x->set_collapse_duplicates(mode == COLLAPSED);
+        for (auto& y : input) x->add(interval<uint64_t>(y.l, y.r, y.id));
+        x->index();
+    }
+    std::string d = forest_difference(sequential, chunked);
+    if (d.empty() && db.backend() == BACKEND_FULL_STOP) d = forest_difference(sequential, db);
+    if (!d.empty()) rep.fail("chunked sweep differs from the sequential sweep at " + d, 0);
+}
+
+// copies placed for NUMA answer like the index on every node
+// first touch queries the index itself and every copy is made by the same relocation,
+// so only the interleaved copy is checked everywhere and the rest at a sample of positions
+void check_numa(index_type& db, const expectation& e, report& rep) {
+    auto records = records_of(db);
+    for (auto placement : { NUMA_FIRST_TOUCH, NUMA_INTERLEAVE, NUMA_REPLICATE }) {
+        if (placement != NUMA_FIRST_TOUCH && db.backend() != BACKEND_FULL_STOP) continue;
+        numa_index<uint64_t> placed(db, placement);
+        auto placed_records = [&](const interval_node<uint64_t>* x, const auto& f) {
+            records(&db.a[placed.node_id(x)], f);
+        };
+        for (uint64_t k = 0; k < placed.node_count(); ++k) {
+            auto query = [&placed, k](const uint64_t& q) { return placed.query(k, q); };
+            if (placement == NUMA_INTERLEAVE && k == 0) {
+                check_all(query, e, placed_records, rep);
+            } else {
+                check_sampled(query, e, placed_records, rep, 4096);
+            }
+        }
+    }
+}
+
+// the archive decodes to the same forest everywhere, and through a cache of one block at a sample of positions,
+// from an OpenMP team and from plain threads sharing it
+// an index without a forest cannot be archived
+void check_archive(index_type& db, const expectation& e, const uint64_t& seed, const options& opts, report& rep) {
+    std::string fname = opts.base + ".archive";
+    if (db.backend() == BACKEND_SORTED) {
+        // nothing to archive, which must be refused before anything is written
+        try {
+            write_archive(db, fname);
+            rep.fail("archived an index without a forest", 0);
+        } catch (std::invalid_argument&) { }
+        std::ifstream written(fname.c_str());
+        if (written.good()) rep.fail("refused archive left a file behind", 0);
+        return;
+    }
+    auto records = records_of(db);
+    write_archive(db, fname, 1 + seed % 200);
+    {
+        archived_index<uint64_t> archived(fname);
+        archived_index<uint64_t> evicting(fname, 1);
+        auto archived_records = [&](const archived_node* x, const auto& f) {
+            records(&db.a[x->id], f);
+        };
+        auto check_at = [&](archived_index<uint64_t>& index, const uint64_t& q) {
+            std::vector<archived_node> found = index.query(q);
+            std::vector<const archived_node*> output;
+            for (auto& x : found) output.push_back(&x);
+            check(output, q, e, archived_records, rep);
+        };
+#pragma omp parallel for schedule(dynamic, 4096)
+        for (uint64_t q = 1; q <= e.bigN+1; ++q) check_at(archived, q);
+#pragma omp parallel for schedule(dynamic, 16)
+        for (uint64_t k = 0; k < 4096; ++k) check_at(evicting, 1 + k * e.bigN / 4096);
+        // threads OpenMP did not start, like the server's workers, each need a cache of their own
+        std::vector<std::thread> threads;
+        for (uint64_t t = 0; t < 8; ++t) {
+            threads.emplace_back([&, t](void) {
+                    for (uint64_t k = 0; k < 16384; ++k) check_at(evicting, 1 + (k * 4099 + t) % e.bigN);
+                });
+        }
+        for (auto& t : threads) t.join();
+    }
+    std::remove(fname.c_str());
+}
+
+// the shape stats must account for every node and position
+void check_stats(index_type& db, const expectation& e, const build_mode& mode, report& rep) {
+    index_stats st = db.stats();
+    uint64_t groups = 0, depth_total = 0, stop_runs = 0;
+#pragma omp parallel for reduction(+:groups)
+    for (uint64_t i = 0; i < db.n; ++i) groups += i == 0 || db.a[i-1].l != db.a[i].l;
+    for (auto& c : st.depth_histogram) depth_total += c;
+    for (auto& c : st.stop_run_histogram) stop_runs += c;
+    double stabbed = 0;
+#pragma omp parallel for reduction(+:stabbed)
+    for (uint64_t q = 1; q <= e.bigN; ++q) stabbed += e.depth[q];
+    if (db.backend() == BACKEND_SORTED) depth_total = groups; // no forest to measure
+    if (depth_total != groups || stop_runs != st.stop_runs || st.nodes != db.n) {
+        rep.fail("stats count " + std::to_string(depth_total) + " groups and "
+                 + std::to_string(stop_runs) + " stop runs", 0);
+    } else if (mode != COLLAPSED && st.domain
+               && std::abs(st.mean_stabbed * st.domain - stabbed) > 1e-6 * stabbed) {
+        rep.fail("stats expect " + std::to_string(st.mean_stabbed) + " stabbed per position", 0);
+    }
+}
+
+// enclosure and containment over random windows, against a scan of the input
+void check_windows(index_type& db, const std::vector<span>& input, const uint64_t& seed,
+                   const options& opts, report& rep) {
+    auto records = records_of(db);
+    std::mt19937_64 windows(seed);
+    int count = input.size() <= brute_force_limit ? 64 : 4;
+    for (int k = 0; k < count; ++k) {
+        uint64_t lo = 1 + windows() % opts.bigN;
+        uint64_t w = windows() % (2*opts.max_length + 1);
+        uint64_t hi = std::min(opts.bigN, lo + (k % 2 ? w : w / 16));
+        check_window("enclosing", db.enclosing(lo, hi), input,
+                     [&](const auto& x) { return x.l <= lo && x.r >= hi; }, records, lo, rep);
+        auto contained = db.contained_in(lo, hi);
+        check_window("contained_in", contained, input,
+                     [&](const auto& x) { return x.l >= lo && x.r <= hi; }, records, lo, rep);
+        if (!std::is_sorted(contained.begin(), contained.end())) {
+            rep.fail("contained_in out of start order", lo);
+        }
+    }
+}
+
+// precomputed sums everywhere, maxima where they are cheap to recompute
+void check_aggregates(index_type& db, const std::vector<span>& input, const options& opts, report& rep) {
+    // payload sums by difference array
+    std::vector<uint64_t> id_sum(opts.bigN+2, 0);
+    for (auto& x : input) {
+        id_sum[x.l] += x.id;
+        id_sum[x.r+1] -= x.id;
+    }
+    for (uint64_t q = 1; q <= opts.bigN+1; ++q) id_sum[q] += id_sum[q-1];
+    stabbing_aggregate<sum_monoid<uint64_t>> sums(db);
+    stabbing_aggregate<max_monoid<uint64_t>> maxima(db);
+#pragma omp parallel for schedule(dynamic, 4096)
+    for (uint64_t q = 1; q <= opts.bigN+1; ++q) {
+        if (sums.aggregate(q) != id_sum[q]) {
+            rep.fail("aggregate sum is " + std::to_string(sums.aggregate(q))
+                     + " instead of " + std::to_string(id_sum[q]), q);
+        }
+        if (q % 7) continue;
+        uint64_t m = max_monoid<uint64_t>::identity();
+        for (auto& x : db.query(q)) {
+            auto run = db.payloads(x);
+            for (auto v = run.first; v != run.second; ++v) m = std::max(m, *v);
+        }
+        if (maxima.aggregate(q) != m) {
+            rep.fail("aggregate max is " + std::to_string(maxima.aggregate(q))
+                     + " instead of " + std::to_string(m), q);
+        }
+    }
+}
+
+// filtered queries must match filtering the full result
+void check_filters(index_type& db, const options& opts, report& rep) {
+    db.build_categories(3, [&db](const interval_node<uint64_t>* x) { return db.value(x) % 3; });
+#pragma omp parallel for schedule(dynamic, 1024)
+    for (uint64_t q = 1; q <= opts.bigN; q += 5) {
+        auto all = db.query(q);
+        std::vector<interval_node<uint64_t>*> even, second;
+        for (auto& x : all) {
+            if (db.value(x) % 2 == 0) even.push_back(x);
+            if (db.value(x) % 3 == 2) second.push_back(x);
+        }
+        if (db.query_if(q, [&db](const interval_node<uint64_t>* x) { return db.value(x) % 2 == 0; }) != even
+            || db.query_category(q, 2) != second) {
+            rep.fail("filtered query differs from the filtered full result", q);
+        }
+    }
+}
+
+// samples must be distinct stabbed nodes, as many as asked for or all of them
+void check_samples(index_type& db, const uint64_t& seed, const options& opts, report& rep) {
+    std::mt19937_64 draws(mix(seed ^ 1));
+    for (int k = 0; k < 256; ++k) {
+        uint64_t q = k % 2 ? 1 + draws() % opts.bigN : db.a[draws() % db.n].l;
+        uint64_t want = 1 + draws() % 64;
+        uint64_t d = db.query(q).size();
+        auto picked = db.sample(q, want, draws);
+        std::sort(picked.begin(), picked.end());
+        if (picked.size() != std::min(want, d) || db.depth(q) != d
+            || std::unique(picked.begin(), picked.end()) != picked.end()) {
+            rep.fail("sample returned " + std::to_string(picked.size()) + " of "
+                     + std::to_string(want) + " at depth " + std::to_string(d), q);
+        }
+        for (auto& x : picked) {
+            if (x->l > q || x->r < q) rep.fail("sample returned an interval not stabbed", q);
+        }
+    }
+}
+
+// nearest lookups against the node distances, brute force
+void check_nearest(index_type& db, const uint64_t& seed, const options& opts, report& rep) {
+    std::mt19937_64 draws(mix(seed ^ 2));
+    std::vector<std::pair<uint64_t, uint64_t>> probes(db.n <= brute_force_limit ? 64 : 4);
+    for (auto& p : probes) {
+        p.first = 1 + draws() % opts.bigN;
+        p.second = 1 + draws() % 16;
+    }
+#pragma omp parallel for schedule(dynamic, 1)
+    for (uint64_t k = 0; k < probes.size(); ++k) {
+        uint64_t q = probes[k].first;
+        uint64_t want = probes[k].second;
+        auto distance = [&q](const interval_node<uint64_t>& x) {
+            return x.r < q ? q - x.r : x.l > q ? x.l - q : 0; };
+        // the want smallest distances, largest on top
+        std::priority_queue<uint64_t> closest;
+        uint64_t max_left = 0, min_right = 0;
+        for (auto& x : db.a) {
+            uint64_t d = distance(x);
+            if (closest.size() < want) {
+                closest.push(d);
+            } else if (d < closest.top()) {
+                closest.pop();
+                closest.push(d);
+            }
+            if (x.r < q) max_left = std::max(max_left, x.r);
+            if (x.l > q && (min_right == 0 || x.l < min_right)) min_right = x.l;
+        }
+        auto* left = db.nearest_left(q);
+        auto* right = db.nearest_right(q);
+        if ((left ? left->r : 0) != max_left || (right ? right->l : 0) != min_right) {
+            rep.fail("nearest interval is not the closest", q);
+        }
+        std::vector<uint64_t> distances(closest.size());
+        for (uint64_t i = distances.size(); i > 0; --i) {
+            distances[i-1] = closest.top();
+            closest.pop();
+        }
+        std::vector<uint64_t> found;
+        for (auto& x : db.k_nearest(q, want)) found.push_back(distance(*x));
+        if (found != distances) {
+            rep.fail("k_nearest is not the closest " + std::to_string(want), q);
+        }
+    }
+}
+
+// the cursor must agree with the expectation, at every position of small domains
+void check_cursor(index_type& db, const expectation& e, report& rep) {
+    uint64_t stride = e.bigN <= brute_force_limit ? 1 : e.bigN / brute_force_limit + 1;
+    sweep_cursor<uint64_t> cursor = db.cursor();
+    for (uint64_t q = 1; q <= e.bigN; q += stride) {
+        cursor.advance(q);
+        uint64_t depth = 0;
+        for (auto& x : cursor.stabbed()) depth += db.multiplicity(x);
+        if (depth != e.depth[q]) {
+            rep.fail("cursor holds " + std::to_string(depth)
+                     + " intervals instead of " + std::to_string(e.depth[q]), q);
+            break;
+        }
+    }
+}
+
+// the coverage track must agree with the same expectation
+void check_coverage(index_type& db, const expectation& e, report& rep) {
+    std::vector<coverage_run> runs = db.coverage();
+    uint64_t covered = 0, expected_covered = 0;
+#pragma omp parallel for schedule(dynamic, 1024) reduction(+:covered)
+    for (uint64_t k = 0; k < runs.size(); ++k) {
+        auto& run = runs[k];
+        for (uint64_t q = run.l; q <= run.r; ++q) {
+            if (e.depth[q] != run.depth) {
+                rep.fail("coverage has depth " + std::to_string(run.depth)
+                         + " instead of " + std::to_string(e.depth[q]), q);
+                break;
+            }
+        }
+        covered += run.r - run.l + 1;
+    }
+#pragma omp parallel for reduction(+:expected_covered)
+    for (uint64_t q = 1; q <= e.bigN; ++q) expected_covered += e.depth[q] > 0;
+    if (covered != expected_covered) {
+        rep.fail("coverage spans " + std::to_string(covered) + " positions instead of "
+                 + std::to_string(expected_covered), 0);
+    }
+}
+
+// every overlapping pair with a smaller uniform set once, from per-thread sums
+void check_join(index_type& db, const std::vector<span>& input, const uint64_t& seed,
+                const options& opts, report& rep) {
+    std::vector<span> other = generate(UNIFORM, opts.n / 16 + 1, opts.bigN, opts.max_length, mix(seed));
+    join_expectation je = expect_join(input, other);
+    faststabbing<uint64_t, anonymous_storage> joined;
+    for (auto& y : other) joined.add(interval<uint64_t>(y.l, y.r, y.id));
+    joined.index();
+    std::vector<join_expectation> found(get_thread_count());
+    join(db, joined, [&](const interval_node<uint64_t>* x, const interval_node<uint64_t>* y) {
+            join_expectation& f = found[omp_get_thread_num()];
+            if (x->l > y->r || y->l > x->r) {
+                rep.fail("join paired [" + std::to_string(x->l) + "," + std::to_string(x->r) + "] with ["
+                         + std::to_string(y->l) + "," + std::to_string(y->r) + "]", 0);
+            }
+            uint64_t h = hash(y->l, y->r, joined.value(y));
+            auto run = db.payloads(x);
+            for (auto v = run.first; v != run.second; ++v) {
+                ++f.pairs;
+                f.hash_sum += mix(*v) * h;
+            }
+        });
+    join_expectation total;
+    for (auto& f : found) {
+        total.pairs += f.pairs;
+        total.hash_sum += f.hash_sum;
+    }
+    if (total.pairs != je.pairs) {
+        rep.fail("join found " + std::to_string(total.pairs) + " pairs instead of "
+                 + std::to_string(je.pairs), 0);
+    } else if (total.hash_sum != je.hash_sum) {
+        rep.fail("join found the right number of pairs but the wrong ones", 0);
+    }
+}
+
+// names of every length, empty ones included, go through a bed file and the blob store and back
+void check_blobs(const std::vector<span>& input, const uint64_t& seed, const options& opts, report& rep) {
+    uint64_t count = std::min((uint64_t)input.size(), (uint64_t)1 << 16);
+    auto name_of = [&seed](const span& x) {
+        uint64_t h = mix(seed ^ x.id);
+        std::string name(x.id % 97 == 0 ? 1000 + h % 1000 : h % 24, ' ');
+        for (auto& c : name) {
+            c = "abcdefghijklmnopqrstuvwxyz0123456789_.-"[h % 39];
+            h = mix(h);
+        }
+        return name;
+    };
+    std::string bed = opts.base + ".names.bed";
+    {
+        std::ofstream out(bed.c_str());
+        for (uint64_t i = 0; i < count; ++i) {
+            auto& x = input[i];
+            out << "chr1\t" << x.l - 1 << "\t" << x.r;
+            std::string name = name_of(x);
+            if (!name.empty() || i % 2) out << "\t" << name; // no name column at all, or an empty one
+            out << "\n";
+        }
+    }
+    std::vector<std::string> expected, found;
+    {
+        faststabbing<blob_ref, anonymous_storage> named;
+        blob_store names(opts.base + ".names");
+        if (load_named_intervals(bed, named, names) != count) {
+            rep.fail("loaded a different number of named records", 0);
+        }
+        named.index();
+        auto key = [](const uint64_t& l, const uint64_t& r, const std::string& name) {
+            return std::to_string(l) + "\t" + std::to_string(r) + "\t" + name;
+        };
+        for (uint64_t i = 0; i < count; ++i) expected.push_back(key(input[i].l, input[i].r, name_of(input[i])));
+        for (uint64_t i = 0; i < named.n; ++i) {
+            auto run = named.payloads(&named.a[i]);
+            for (auto v = run.first; v != run.second; ++v) found.push_back(key(named.a[i].l, named.a[i].r, names.get(*v)));
+        }
+        // and through queries, at positions some record starts at
+        for (uint64_t k = 0; k < 64 && count; ++k) {
+            uint64_t q = input[mix(seed + k) % count].l;
+            std::vector<std::string> want, got;
+            for (uint64_t i = 0; i < count; ++i) {
+                if (input[i].l <= q && q <= input[i].r) want.push_back(name_of(input[i]));
+            }
+            named.for_each_stabbed(q, [&](const interval_node<blob_ref>* x) {
+                    auto run = named.payloads(x);
+                    for (auto v = run.first; v != run.second; ++v) got.push_back(names.get(*v));
+                });
+            std::sort(want.begin(), want.end());
+            std::sort(got.begin(), got.end());
+            if (want != got) rep.fail("named query returned the wrong names", q);
+        }
+    }
+    std::remove(bed.c_str());
+    std::sort(expected.begin(), expected.end());
+    std::sort(found.begin(), found.end());
+    if (expected != found) rep.fail("named records differ from the bed file", 0);
+}
+
+uint64_t run(const shape& s, const uint64_t& round, const build_mode& mode, const options& opts) {
+    auto start = std::chrono::steady_clock::now();
+    uint64_t seed = mix(opts.seed + round);
+    std::vector<span> input = generate(s, opts.n, opts.bigN, opts.max_length, seed);
+    expectation e = expect(input, opts.bigN, true);
+    faststabbing<uint64_t> db(opts.base);
+    build(db, input, mode, opts);
+    report rep;
+    check_all([&db](const uint64_t& q) { return db.query(q); }, e, records_of(db), rep);
+    check_sweep(db, input, mode, seed, rep);
+    if (mode == MERGED) check_merge(input, rep);
+    check_numa(db, e, rep);
+    check_archive(db, e, seed, opts, rep);
+    check_stats(db, e, mode, rep);
+    check_windows(db, input, seed, opts, rep);
+    check_aggregates(db, input, opts, rep);
+    check_join(db, input, seed, opts, rep);
+    if (mode == PLAIN) check_blobs(input, seed, opts, rep);
+    std::vector<span>().swap(input);
+    check_filters(db, opts, rep);
+    check_samples(db, seed, opts, rep);
+    check_nearest(db, seed, opts, rep);
+    check_cursor(db, e, rep);
+    check_coverage(db, e, rep);
+    std::cerr << build_mode_name(mode) << "\t" << shape_name(s) << "\t" << round << "\t"
+              << (rep.failed() ? "FAIL" : "ok") << "\t" << seconds_since(start) << "s" << std::endl;
+    return rep.failed();
+}
+
+int main(int argc, char** argv) {
+    options opts;
+    int status = 0;
+    if (!parse(argc, argv, "differential test of the memory-mapped stabbing index", opts, status)) {
+        return status;
+    }
+    uint64_t failed = 0;
+    for (int s = 0; s < SHAPE_COUNT; ++s) {
+        for (uint64_t round = 0; round < opts.rounds; ++round) {
+            for (int mode = 0; mode < BUILD_MODE_COUNT; ++mode) {
+                failed += run((shape)s, round, (build_mode)mode, opts);
+            }
+        }
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,163 @@
+/************************************************************
+Copyright (C) 2009 Jens M. Schmidt
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+or 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+************************************************************/
+
+// differential test of intervalstab-serve, through its client, against the same index built in process
+
+#include <tuple>
+#include <memory>
+#include <thread>
+#include <csignal>
+#include <sys/wait.h>
+#include "mmintervalstab.hpp"
+#include "serve_protocol.hpp"
+#include "differential.hpp"
+
+using namespace intervalstab;
+using namespace intervalstab::differential;
+
+// one (l, r, value) per input interval, sorted, as replies may order records differently
+typedef std::vector<std::tuple<uint64_t, uint64_t, uint64_t>> record_set;
+
+record_set local_records(faststabbing<uint64_t, anonymous_storage>& db,
+                         const std::vector<interval_node<uint64_t>*>& found) {
+    record_set out;
+    for (auto& x : found) {
+        auto run = db.payloads(x);
+        for (auto v = run.first; v != run.second; ++v) out.push_back(std::make_tuple(x->l, x->r, *v));
+    }
+    std::sort(out.begin(), out.end());
+    return out;
+}
+
+record_set served_records(const std::vector<serve::result>& found) {
+    record_set out;
+    for (auto& x : found) out.push_back(std::make_tuple(x.l, x.r, x.value));
+    std::sort(out.begin(), out.end());
+    return out;
+}
+
+// start the server and connect once it listens, nullptr if it exits or never does
+std::unique_ptr<serve::client> start_server(const options& opts, const std::string& intervals,
+                                            const std::string& socket, const bool& collapse, pid_t& pid) {
+    std::string index = socket + ".index";
+    std::vector<const char*> argv = { opts.server.c_str(), "-s", socket.c_str(), "-i", intervals.c_str(),
+                                      "-T", index.c_str(), "-t", "2", "--no-prewarm" };
+    if (collapse) argv.push_back("-u");
+    argv.push_back(nullptr);
+    pid = ::fork();
+    if (pid == 0) {
+        ::execv(argv[0], (char* const*)argv.data());
+        ::_exit(127);
+    }
+    for (int tries = 0; tries < 1200; ++tries) {
+        int status = 0;
+        if (pid < 0 || ::waitpid(pid, &status, WNOHANG) == pid) return nullptr;
+        try {
+            return std::unique_ptr<serve::client>(new serve::client(socket));
+        } catch (std::runtime_error&) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+    }
+    return nullptr;
+}
+
+uint64_t run(const shape& s, const uint64_t& round, const bool& collapse, const options& opts) {
+    auto start = std::chrono::steady_clock::now();
+    uint64_t seed = mix(opts.seed + round);
+    std::vector<span> input = generate(s, opts.n, opts.bigN, opts.max_length, seed);
+    std::string intervals = opts.base + ".intervals";
+    std::string socket = opts.base + ".sock";
+    {
+        std::ofstream out(intervals.c_str());
+        for (auto& x : input) out << x.l << " " << x.r << " " << x.id << "\n";
+    }
+    faststabbing<uint64_t, anonymous_storage> db;
+    db.set_collapse_duplicates(collapse);
+    for (auto& x : input) db.add(interval<uint64_t>(x.l, x.r, x.id));
+    db.index();
+    report rep;
+    pid_t pid = -1;
+    auto client = start_server(opts, intervals, socket, collapse, pid);
+    bool started = client != nullptr;
+    if (!started) {
+        rep.fail("intervalstab-serve did not start from " + opts.server, 0);
+    } else {
+        // points over the domain and its edges, then past it where nothing is stabbed
+        std::vector<uint64_t> points = { 0, 1, opts.bigN, opts.bigN + 1, opts.bigN + 1000000 };
+        for (uint64_t k = 0; k < 4096; ++k) points.push_back(1 + k * opts.bigN / 4096);
+        for (auto& q : points) {
+            if (served_records(client->point(q)) != local_records(db, db.query(q))) {
+                rep.fail("served point query differs", q);
+            }
+        }
+        // ranges of every width, some reaching out of the domain
+        std::mt19937_64 windows(seed);
+        for (int k = 0; k < 1024; ++k) {
+            uint64_t b = windows() % (opts.bigN + 2);
+            uint64_t e = b + windows() % (k % 4 ? 2*opts.max_length + 1 : opts.bigN + 1);
+            if (served_records(client->range(b, e)) != local_records(db, db.query(b, e))) {
+                rep.fail("served range query to " + std::to_string(e) + " differs", b);
+            }
+        }
+        if (!client->range(opts.bigN + 1, opts.bigN + 100).empty()) {
+            rep.fail("served range past the domain is not empty", opts.bigN + 1);
+        }
+        // a backwards range is rejected, and the connection still answers after it
+        try {
+            client->range(10, 1);
+            rep.fail("served a backwards range", 10);
+        } catch (std::runtime_error&) { }
+        if (served_records(client->point(1)) != local_records(db, db.query(1))) {
+            rep.fail("served point query differs after a rejected request", 1);
+        }
+        client.reset();
+    }
+    if (pid > 0) {
+        int status = 0;
+        ::kill(pid, SIGTERM);
+        ::waitpid(pid, &status, 0);
+        if (started && !(WIFEXITED(status) && WEXITSTATUS(status) == 0)) {
+            rep.fail("intervalstab-serve did not exit cleanly", 0);
+        }
+    }
+    std::remove(intervals.c_str());
+    std::cerr << "serve" << (collapse ? "-collapsed" : "") << "\t" << shape_name(s) << "\t" << round << "\t"
+              << (rep.failed() ? "FAIL" : "ok") << "\t" << seconds_since(start) << "s" << std::endl;
+    return rep.failed();
+}
+
+int main(int argc, char** argv) {
+    options opts;
+    int status = 0;
+    if (!parse(argc, argv, "differential test of intervalstab-serve through its client", opts, status)) {
+        return status;
+    }
+    if (opts.server.empty()) {
+        std::cerr << "error: --server must name the intervalstab-serve binary" << std::endl;
+        return 1;
+    }
+    uint64_t failed = 0;
+    for (int s = 0; s < SHAPE_COUNT; ++s) {
+        for (uint64_t round = 0; round < opts.rounds; ++round) {
+            for (bool collapse : { false, true }) {
+                failed += run((shape)s, round, collapse, opts);
+            }
+        }
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,237 @@
+/************************************************************
+Copyright (C) 2009 Jens M. Schmidt
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+or 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+************************************************************/
+
+#pragma once
+
+// interpolated implicit interval tree
+//
+// the intervals are sorted by start and the array itself is the tree, as in
+// cgranges: index x with k trailing one bits is a node at level k spanning
+// [x - 2^k + 1, x + 2^k - 1], and each node keeps the largest end in its
+// subtree. there is no per-coordinate array, so the footprint is O(n) however
+// large the domain is.
+//
+// rather than descend from the root, a query starts at the leaf predicted by
+// a piecewise linear model of start position to array index, one piece per
+// domain, and climbs until the subtree holds every interval that could be
+// stabbed: nothing left of it ends at or after q and nothing right of it
+// starts at or before q. a good model stops the climb low in the tree.
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include "mmintervalstab.hpp"
+
+namespace intervalstab {
+
+struct iitii_node {
+    uint64_t l = 0;
+    uint64_t r = 0;
+    uint64_t max_end = 0; // largest end in the subtree
+};
+
+template <typename T, typename Storage = mmap_storage>
+class iitii {
+private:
+    template <typename X>
+    using array = typename Storage::template array<X>;
+
+    typename Storage::template spool<interval<T>> input; // intervals added before index()
+    std::string filename;
+    uint64_t domain_count = 1;
+    uint64_t levels = 0; // level of the root
+    uint64_t min_l = 0;
+    uint64_t max_l = 0;
+
+    array<interval<T>> intervals;
+    array<iitii_node> a;
+    array<T> values; // payloads in node order
+    array<uint64_t> reach; // largest end among the nodes up to each one
+    array<uint64_t> domain_first; // first node starting in each domain, and n
+
+    // largest end in the part of subtree (x, k) that exists, 0 if none of it does
+    uint64_t subtree_max(const uint64_t& x, const uint64_t& k) const {
+        if (x - ((1ULL << k) - 1) >= n) return 0;
+        if (x < n) return a[x].max_end;
+        return subtree_max(x - (1ULL << (k-1)), k-1);
+    }
+
+    uint64_t domain_of(const uint64_t& p) const {
+        return (unsigned __int128)(p - min_l) * domain_count / (max_l - min_l + 1);
+    }
+
+    uint64_t domain_start(const uint64_t& d) const {
+        // the smallest position p with domain_of(p) >= d
+        return min_l + ((unsigned __int128)d * (max_l - min_l + 1) + domain_count - 1) / domain_count;
+    }
+
+    // the predicted index of the last node starting at or before q
+    uint64_t predict(const uint64_t& q) const {
+        if (q >= max_l) return n - 1;
+        uint64_t d = domain_of(q);
+        uint64_t p0 = domain_start(d);
+        uint64_t p1 = domain_start(d+1);
+        uint64_t i0 = domain_first[d];
+        uint64_t i1 = domain_first[d+1];
+        uint64_t i = i0 + (unsigned __int128)(i1 - i0) * (q - p0 + 1) / std::max((uint64_t)1, p1 - p0);
+        return i == 0 ? 0 : std::min(i, n) - 1;
+    }
+
+    void preprocessing(void) {
+        input.finish(intervals, intervals_filename());
+        n = intervals.size();
+        ips4o::parallel::sort(intervals.begin(), intervals.end());
+        a.allocate(node_filename(), n);
+        values.allocate(values_filename(), n);
+        reach.allocate(reach_filename(), n);
+        uint64_t running = 0;
+        for (uint64_t i = 0; i < n; ++i) {
+            auto& o = intervals[i];
+            a[i].l = o.l;
+            a[i].r = o.r;
+            a[i].max_end = o.r;
+            values[i] = o.value;
+            running = std::max(running, o.r);
+            reach[i] = running;
+        }
+        intervals.release();
+        // max ends level by level, leaves already hold their own end
+        levels = 0;
+        while ((1ULL << (levels+1)) - 1 < n) ++levels;
+        for (uint64_t k = 1; k <= levels; ++k) {
+            uint64_t half = 1ULL << (k-1);
+#pragma omp parallel for
+            for (uint64_t x = (1ULL << k) - 1; x < n; x += 1ULL << (k+1)) {
+                a[x].max_end = std::max(a[x].r, std::max(subtree_max(x - half, k-1),
+                                                         subtree_max(x + half, k-1)));
+            }
+        }
+        // one linear model per domain between the first nodes of it and the next
+        min_l = n ? a[0].l : 0;
+        max_l = n ? a[n-1].l : 0;
+        domain_first.allocate(domain_filename(), domain_count+1);
+        for (uint64_t d = 0, i = 0; d <= domain_count; ++d) {
+            uint64_t p = domain_start(d);
+            while (i < n && a[i].l < p) ++i;
+            domain_first[d] = i;
+        }
+    }
+
+public:
+
+    typedef interval<T> interval_type;
+
+    uint64_t n = 0;
+
+    /// f is the base name of the index files, which anonymous storage does without
+    iitii(const std::string& f = std::string())
+        : filename(f) {
+        input.open(f.empty() ? f : f + ".iitii");
+    }
+
+    std::string intervals_filename(void) {
+        return filename + ".iitii.intervals";
+    }
+
+    std::string node_filename(void) {
+        return filename + ".iitii.nodes";
+    }
+
+    std::string values_filename(void) {
+        return filename + ".iitii.values";
+    }
+
+    std::string reach_filename(void) {
+        return filename + ".iitii.reach";
+    }
+
+    std::string domain_filename(void) {
+        return filename + ".iitii.domains";
+    }
+
+    /// the number of pieces in the start position model, set before index()
+    void set_domains(const uint64_t& d) {
+        domain_count = std::max((uint64_t)1, d);
+    }
+
+    void add(const interval<T>& it) {
+        input.add(it);
+    }
+
+    void index(void) {
+        preprocessing();
+    }
+
+    /// return the number of records, which will only work after indexing
+    size_t size(void) const {
+        return n;
+    }
+
+    /// the payload of a node
+    const T& value(const iitii_node* x) const {
+        return values[x - &a[0]];
+    }
+
+    /// the nodes stabbed at q, in start order
+    std::vector<iitii_node*> query(const uint64_t& q) {
+        std::vector<iitii_node*> output;
+        if (n == 0 || q < min_l) return output;
+        // climb from the predicted leaf until the subtree holds every stabbed interval
+        uint64_t x = predict(q);
+        uint64_t k = 0;
+        for (uint64_t y = x; y & 1; y >>= 1) ++k;
+        while (k < levels) {
+            uint64_t lo = x - ((1ULL << k) - 1);
+            uint64_t hi = x + (1ULL << k) - 1;
+            bool left_done = lo == 0 || reach[lo-1] < q;
+            bool right_done = hi + 1 >= n || a[hi+1].l > q;
+            if (left_done && right_done) break;
+            x = (x >> (k+1)) & 1 ? x - (1ULL << k) : x + (1ULL << k);
+            ++k;
+        }
+        // descend, pruning subtrees that end before q and right halves that start after it
+        // each level leaves at most two entries behind, so the stack is bounded by the height
+        std::pair<uint64_t, uint64_t> stack[2*64+2];
+        uint64_t depth = 0;
+        stack[depth++] = std::make_pair(x, k);
+        while (depth) {
+            uint64_t y = stack[--depth].first;
+            uint64_t j = stack[depth].second;
+            uint64_t lo = y - ((1ULL << j) - 1);
+            if (lo >= n) continue;
+            if (j <= 2) {
+                // small subtrees are cheaper to scan
+                uint64_t hi = std::min<uint64_t>(n - 1, y + (1ULL << j) - 1);
+                for (uint64_t i = lo; i <= hi && a[i].l <= q; ++i) {
+                    if (a[i].r >= q) output.push_back(&a[i]);
+                }
+                continue;
+            }
+            if (subtree_max(y, j) < q) continue;
+            uint64_t half = 1ULL << (j-1);
+            if (y < n && a[y].l <= q) {
+                stack[depth++] = std::make_pair(y + half, j-1);
+                if (a[y].r >= q) stack[depth++] = std::make_pair(y, 0); // as a leaf, to keep start order
+            }
+            stack[depth++] = std::make_pair(y - half, j-1);
+        }
+        return output;
+    }
+};
+
+}
@@ -0,0 +1,109 @@
+/************************************************************
+Copyright (C) 2009 Jens M. Schmidt
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+or 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+************************************************************/
+
+#pragma once
+
+// reading intervals from text files into an index
+
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <stdexcept>
+#include "blob_store.hpp"
+
+namespace intervalstab {
+
+// load intervals into db, returning how many were added
+//
+// plain input has one interval per line as "start end [value]", 1-based and closed
+// bed input is "seq start end ...", 0-based and half-open, and the value is the record number
+// empty lines and lines starting with '#', "track" or "browser" are skipped
+template <typename Index>
+uint64_t load_intervals(const std::string& fname, const bool& bed, Index& db) {
+    std::ifstream in(fname.c_str());
+    if (in.fail()) {
+        throw std::ios_base::failure(fname + ": " + std::strerror(errno));
+    }
+    std::string line;
+    uint64_t count = 0;
+    uint64_t line_number = 0;
+    while (std::getline(in, line)) {
+        ++line_number;
+        if (line.empty() || line[0] == '#'
+            || line.compare(0, 5, "track") == 0 || line.compare(0, 7, "browser") == 0) {
+            continue;
+        }
+        std::istringstream fields(line);
+        uint64_t l = 0, r = 0, value = count;
+        std::string seq;
+        if (bed) fields >> seq;
+        fields >> l >> r;
+        if (!fields) {
+            throw std::runtime_error(fname + ":" + std::to_string(line_number) + ": bad interval");
+        }
+        if (bed) {
+            l += 1; // closed and 1-based, an empty record still covers its start
+            r = std::max(l, r);
+        } else if (!(fields >> value)) {
+            value = count;
+        }
+        if (l == 0 || r < l) {
+            throw std::runtime_error(fname + ":" + std::to_string(line_number) + ": bad interval");
+        }
+        db.add(typename Index::interval_type(l, r, value));
+        ++count;
+    }
+    return count;
+}
+
+// load bed records into an index whose payload is the record's name (the fourth column, if any),
+// stored in names, which is sealed once everything is read
+template <typename Index>
+uint64_t load_named_intervals(const std::string& fname, Index& db, blob_store& names) {
+    std::ifstream in(fname.c_str());
+    if (in.fail()) {
+        throw std::ios_base::failure(fname + ": " + std::strerror(errno));
+    }
+    std::string line;
+    uint64_t count = 0;
+    uint64_t line_number = 0;
+    while (std::getline(in, line)) {
+        ++line_number;
+        if (line.empty() || line[0] == '#'
+            || line.compare(0, 5, "track") == 0 || line.compare(0, 7, "browser") == 0) {
+            continue;
+        }
+        std::istringstream fields(line);
+        uint64_t l = 0, r = 0;
+        std::string seq, name;
+        fields >> seq >> l >> r;
+        if (!fields) {
+            throw std::runtime_error(fname + ":" + std::to_string(line_number) + ": bad interval");
+        }
+        fields >> name;
+        l += 1;
+        r = std::max(l, r);
+        db.add(typename Index::interval_type(l, r, names.add(name)));
+        ++count;
+    }
+    names.seal();
+    return count;
+}
+
+}
@@ -0,0 +1,99 @@
+/************************************************************
+Copyright (C) 2009 Jens M. Schmidt
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+or 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+************************************************************/
+
+#pragma once
+
+// overlap join of two indexes
+//
+// every overlapping pair (x from A, y from B) is reported once, at the
+// position where the later of the two starts. the domain is cut into chunks
+// swept in parallel: a chunk seeds its active sets with the intervals
+// stabbed at its first position that started before it, then walks the
+// starts of both node arrays in order, pairing each start with the active
+// intervals of the other side and dropping expired ones as it passes them.
+// each active interval scanned is either reported or dropped, so the work
+// is O(nA + nB + output) plus one stabbing query per chunk and side.
+
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+#include <omp.h>
+#include "mmintervalstab.hpp"
+
+namespace intervalstab {
+
+// call sink(x, y) for every node x of A overlapping a node y of B
+// sink is called concurrently from several threads, each pair exactly once,
+// and within a thread in increasing order of the later start
+template <typename IndexA, typename IndexB, typename Sink>
+void join(IndexA& A, IndexB& B, const Sink& sink) {
+    typedef typename std::remove_reference<decltype(*A.a.data())>::type node_a;
+    typedef typename std::remove_reference<decltype(*B.a.data())>::type node_b;
+    uint64_t domain = std::max(A.bigN, B.bigN);
+    if (A.n == 0 || B.n == 0 || domain == 0) return;
+    // several chunks per thread so uneven density still balances
+    uint64_t chunk_count = 4 * get_thread_count();
+    uint64_t chunk_size = domain / chunk_count + 1;
+#pragma omp parallel for schedule(dynamic, 1)
+    for (uint64_t c = 0; c < chunk_count; ++c) {
+        uint64_t begin = 1 + c * chunk_size;
+        uint64_t last = std::min(domain, begin + chunk_size - 1);
+        if (begin > last) continue;
+        // intervals already open when the chunk begins
+        std::vector<node_a*> active_a;
+        std::vector<node_b*> active_b;
+        for (auto& x : A.query(begin)) if (x->l < begin) active_a.push_back(x);
+        for (auto& y : B.query(begin)) if (y->l < begin) active_b.push_back(y);
+        // starts in the chunk, in start order
+        uint64_t i = std::lower_bound(A.a.begin(), A.a.end(), begin,
+                                      [](const node_a& x, const uint64_t& p) { return x.l < p; }) - A.a.begin();
+        uint64_t j = std::lower_bound(B.a.begin(), B.a.end(), begin,
+                                      [](const node_b& y, const uint64_t& p) { return y.l < p; }) - B.a.begin();
+        while (true) {
+            bool more_a = i < A.n && A.a[i].l <= last;
+            bool more_b = j < B.n && B.a[j].l <= last;
+            if (!more_a && !more_b) break;
+            // at equal starts A goes first, so the B start sees it as active
+            if (more_a && (!more_b || A.a[i].l <= B.a[j].l)) {
+                node_a* x = &A.a[i++];
+                for (uint64_t k = 0; k < active_b.size(); ) {
+                    if (active_b[k]->r < x->l) {
+                        active_b[k] = active_b.back();
+                        active_b.pop_back();
+                    } else {
+                        sink(x, active_b[k++]);
+                    }
+                }
+                active_a.push_back(x);
+            } else {
+                node_b* y = &B.a[j++];
+                for (uint64_t k = 0; k < active_a.size(); ) {
+                    if (active_a[k]->r < y->l) {
+                        active_a[k] = active_a.back();
+                        active_a.pop_back();
+                    } else {
+                        sink(active_a[k++], y);
+                    }
+                }
+                active_b.push_back(y);
+            }
+        }
+    }
+}
+
+}
@@ -20,7 +20,14 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include <iostream>
 #include <vector>
 #include <random>
+#include <chrono>
+#include <memory>
 #include "mmintervalstab.hpp"
+#include "iitii.hpp"
+#include "numa.hpp"
+#include "archive.hpp"
+#include "input.hpp"
+#include "workload.hpp"
 #include "args.hxx"
 
 using namespace intervalstab;
@@ -34,9 +41,25 @@ int main(int argc, char** argv) {
     args::ValueFlag<uint64_t> max_val(parser, "N", "generate test data in the range [1,max_value]", {'M', "max-value"});
     args::ValueFlag<uint64_t> range_mean(parser, "N", "the mean length for intervals (under gaussian distribution)", {'m', "range-mean"});
     args::ValueFlag<double> range_stdev(parser, "N", "the standard deviation for intervals (under gaussian distribution)", {'D', "range-stdev"});
+    args::ValueFlag<std::string> interval_dist(parser, "NAME", "interval distribution: gaussian, uniform, exponential, hotspot, nested or genome", {'L', "length-dist"}, "gaussian");
+    args::ValueFlag<uint64_t> hotspots(parser, "N", "number of zipf-weighted hotspots for the hotspot and genome distributions", {'H', "hotspots"});
+    args::ValueFlag<uint64_t> query_count(parser, "N", "benchmark this many random queries instead of checking every position", {'q', "queries"});
+    args::ValueFlag<std::string> query_dist(parser, "NAME", "query distribution: uniform, hotspot or scan", {'Q', "query-dist"}, "uniform");
+    args::ValueFlag<std::string> record_queries(parser, "FILE", "record the benchmark queries to this trace file", {'w', "record-queries"});
+    args::ValueFlag<std::string> replay_queries(parser, "FILE", "benchmark the queries replayed from this trace file", {'R', "replay-queries"});
+    args::ValueFlag<std::string> numa(parser, "NAME", "benchmark on workers pinned to every NUMA node, with the query structures left where the build put them (first-touch), interleaved over the nodes (interleave) or copied to each (replicate)", {"numa"});
     args::ValueFlag<uint64_t> threads(parser, "N", "number of threads to use", {'t', "threads"});
-    args::ValueFlag<uint64_t> domains(parser, "N", "number of domains for interpolation", {'d', "domains"});
+    args::ValueFlag<uint64_t> domains(parser, "N", "use the interpolated implicit interval tree with this many domains", {'d', "domains"});
     args::ValueFlag<uint64_t> random_seed(parser, "N", "a random seed for the algorithm", {'S', "random-seed"});
+    args::ValueFlag<std::string> backend(parser, "NAME", "query backend: auto (chosen from the data), full-stop, stop-runs or sorted", {"backend"}, "auto");
+    args::Flag collapse(parser, "collapse", "store identical intervals once with a run of payloads", {'u', "collapse-duplicates"});
+    args::ValueFlag<std::string> bedgraph_out(parser, "FILE", "write the depth track of the test data to this bedGraph file", {'b', "bedgraph"});
+    args::ValueFlag<std::string> coverage_out(parser, "FILE", "write the depth track of the test data to this binary run file", {'c', "coverage"});
+    args::Flag profile(parser, "profile", "report the time and volume of each build phase as JSON lines on stderr", {"profile"});
+    args::ValueFlag<std::string> archive(parser, "FILE", "write a block-compressed archive of the index to this file and benchmark and check queries against it", {"archive"});
+    args::Flag print_stats(parser, "stats", "print the sizes of the index structures and the shape of the forest", {"stats"});
+    args::ValueFlag<std::string> names_of(parser, "FILE", "index the records of this BED file with their names, then print the records over each position read from stdin", {"names-of"});
+    args::ValueFlag<std::string> seq_name(parser, "NAME", "sequence name to use in the bedGraph output", {"seq-name"}, "chr1");
 
     try {
         parser.ParseCLI(argc, argv);
@@ -52,47 +75,160 @@ int main(int argc, char** argv) {
         std::cout << parser;
         return 1;
     }
+
+    if (names_of) {
+        // a lookup rather than a test: one BED line with its name per stabbed record
+        faststabbing<blob_ref, anonymous_storage> named;
+        blob_store names((test_file ? args::get(test_file) : args::get(names_of)) + ".names");
+        load_named_intervals(args::get(names_of), named, names);
+        named.index();
+        uint64_t q;
+        while (std::cin >> q) {
+            named.for_each_stabbed(q, [&](const interval_node<blob_ref>* x) {
+                    auto run = named.payloads(x);
+                    for (auto v = run.first; v != run.second; ++v) {
+                        std::cout << q << "\t" << x->l - 1 << "\t" << x->r << "\t" << names.get(*v) << "\n";
+                    }
+                });
+        }
+        return 0;
+    }
     
     assert(!args::get(test_file).empty());
     assert(args::get(test_size));
     assert(args::get(max_val));
 
 
-    //std::vector<interval> intervals;
-    
-    //std::remove(args::get(test_file).c_str());
-    //p_iitii::builder bb = p_iitii::builder(args::get(test_file));
-    //p_iitii::builder bb = p_iitii::builder(args::get(test_file));
-    faststabbing<uint64_t> db(args::get(test_file)); //intervals, intervals.size(), max_seen_value);
-
-    //bb.add(intpair(12,34));
-    //bb.add(intpair(0,23));
-    //bb.add(intpair(34,56));
+    faststabbing<uint64_t> db(args::get(test_file));
+    db.set_collapse_duplicates(collapse);
+    db.set_backend(parse_backend(args::get(backend)));
+    // copies for NUMA nodes are made of the stop array, so auto must not pick a backend without one
+    numa_placement placement = numa ? parse_numa_placement(args::get(numa)) : NUMA_FIRST_TOUCH;
+    if (placement != NUMA_FIRST_TOUCH) {
+        if (parse_backend(args::get(backend)) == BACKEND_AUTO) {
+            db.set_backend(BACKEND_FULL_STOP);
+        } else if (parse_backend(args::get(backend)) != BACKEND_FULL_STOP) {
+            std::cerr << "error: --numa " << args::get(numa) << " copies the stop array, "
+                      << "which only the full-stop backend keeps" << std::endl;
+            return 1;
+        }
+    }
+    if (profile) {
+        db.set_build_observer([](const build_phase& p) { write_build_phase_json(std::cerr, p); });
+    }
+    // with domains the implicit tree is built over the same data, benchmarked and checked
+    // it is only made then, as it opens its spool files at once
+    std::unique_ptr<iitii<uint64_t>> tree;
+    if (domains) {
+        tree.reset(new iitii<uint64_t>(args::get(test_file)));
+        tree->set_domains(args::get(domains));
+    }
 
     std::random_device rd;  //Will be used to obtain a seed for the random number engine
-    std::mt19937 gen(args::get(random_seed)?args::get(random_seed):rd()); //Standard mersenne_twister_engine seeded with rd()
-    uint64_t max_value = args::get(max_val);
-    std::uniform_int_distribution<uint64_t> dis(1, max_value);
-    std::normal_distribution<> dlen(args::get(range_mean),args::get(range_stdev));
+    uint64_t seed = args::get(random_seed)?args::get(random_seed):rd();
+    workload::parameters params;
+    params.max_value = args::get(max_val);
+    params.mean = args::get(range_mean);
+    params.stdev = args::get(range_stdev);
+    if (hotspots) params.hotspots = args::get(hotspots);
+    params.hotspot_seed = seed; // queries draw from seed+1 but aim at the same hotspots
+    workload::interval_generator generate(workload::parse_distribution(args::get(interval_dist)), params, seed);
     uint64_t x_len = args::get(test_size);
     uint64_t max_seen_value = 0;
 //#pragma omp parallel for
     for (int n=0; n<x_len; ++n) {
-        uint64_t q = dis(gen);
-        uint64_t r = std::min(q + (uint64_t)std::max((int64_t)0, (int64_t)std::round(dlen(gen))), max_value);
-        max_seen_value = std::max(max_seen_value, r);
-        db.add(interval<uint64_t>(q, r, 0));
+        auto x = generate();
+        max_seen_value = std::max(max_seen_value, x.second);
+        db.add(interval<uint64_t>(x.first, x.second, 0));
+        if (domains) tree->add(interval<uint64_t>(x.first, x.second, 0));
     }
 
     db.index();
-    //tree.index();
+    if (domains) tree->index();
+    if (print_stats) {
+        write_stats(std::cout, db.stats());
+    }
+    std::unique_ptr<archived_index<uint64_t>> archived;
+    if (archive) {
+        if (db.backend() == BACKEND_SORTED) {
+            std::cerr << "error: the sorted backend keeps no forest to archive, "
+                      << "use --backend full-stop or --backend stop-runs with --archive" << std::endl;
+            return 1;
+        }
+        uint64_t bytes = write_archive(db, args::get(archive));
+        archived.reset(new archived_index<uint64_t>(args::get(archive)));
+        index_stats s = db.stats();
+        std::cout << "archive\tbytes\t" << bytes << "\tnode and stop bytes\t" << s.node_bytes + s.stop_bytes
+                  << "\tpayload bytes\t" << s.value_bytes + s.payload_offset_bytes << std::endl;
+    }
 
+    if (!args::get(bedgraph_out).empty() || !args::get(coverage_out).empty()) {
+        std::vector<coverage_run> runs = db.coverage();
+        if (!args::get(bedgraph_out).empty()) {
+            std::ofstream out(args::get(bedgraph_out).c_str());
+            write_bedgraph(out, args::get(seq_name), runs);
+        }
+        if (!args::get(coverage_out).empty()) {
+            write_coverage(args::get(coverage_out), runs);
+        }
+    }
 
-    //p_iitii db = bb.build(n_domains);
-    //p_iitii db = bb.build();
+    if (query_count || replay_queries) {
+        // benchmark a recorded or generated query stream
+        std::vector<uint64_t> queries;
+        if (replay_queries) {
+            queries = workload::read_query_trace(args::get(replay_queries));
+        } else {
+            workload::query_generator next_query(workload::parse_distribution(args::get(query_dist)), params, seed+1);
+            for (uint64_t i = 0; i < args::get(query_count); ++i) {
+                queries.push_back(next_query());
+            }
+        }
+        if (record_queries) {
+            workload::write_query_trace(args::get(record_queries), queries);
+        }
+        if (numa) {
+            // one line per node, so remote and local nodes can be compared
+            numa_index<uint64_t> placed(db, placement);
+            uint64_t per_node = threads ? std::max((uint64_t)1, args::get(threads) / placed.node_count()) : 0;
+            std::vector<uint64_t> counts(queries.size(), 0); // each query is run by one worker
+            auto timings = placed.batch(queries, [&counts](const uint64_t& i, interval_node<uint64_t>* x) {
+                    ++counts[i]; }, per_node);
+            for (auto& t : timings) {
+                std::cout << "node\t" << t.node << "\tworkers\t" << t.workers << "\tqueries\t" << t.queries
+                          << "\tseconds\t" << t.seconds << "\tqueries/s\t" << t.queries / t.seconds << std::endl;
+            }
+            uint64_t outputs = 0;
+            for (auto& c : counts) outputs += c;
+            std::cout << "queries\t" << queries.size() << "\toutputs\t" << outputs << std::endl;
+            return 0;
+        }
+        uint64_t outputs = 0;
+        auto start = std::chrono::steady_clock::now();
+        if (domains) {
+            for (auto& q : queries) {
+                outputs += tree->query(q).size();
+            }
+        } else if (archived) {
+            for (auto& q : queries) {
+                outputs += archived->query(q).size();
+            }
+        } else {
+            for (auto& q : queries) {
+                outputs += db.query(q).size();
+            }
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "queries\t" << queries.size() << "\toutputs\t" << outputs
+                  << "\tseconds\t" << elapsed << "\tqueries/s\t" << queries.size() / elapsed << std::endl;
+        return 0;
+    }
+    // the cursor keeps an independent stabbing set to compare against
+    sweep_cursor<uint64_t> cursor = db.cursor();
 //#pragma omp parallel for
     for (int n=1; n<=max_seen_value; ++n) {
         std::vector<interval_node<uint64_t>*> ovlp = db.query(n);
+        cursor.advance(n);
         if (n % 1000 == 0) std::cerr << n << "\r";
         //std::cerr << n << " has " << ovlp.size() << " overlaps" << std::endl;
         for (auto& s : ovlp) {
@@ -100,6 +236,26 @@ int main(int argc, char** argv) {
                 std::cerr << "tree broken at " << n << std::endl;
             }
         }
+        if (ovlp.size() != cursor.stabbed().size()) {
+            std::cerr << "cursor disagrees at " << n << std::endl;
+        }
+        if (archived && archived->query(n).size() != ovlp.size()) {
+            std::cerr << "archive disagrees at " << n << std::endl;
+        }
+        if (domains) {
+            // the implicit tree keeps duplicates apart
+            uint64_t records = 0;
+            for (auto& s : ovlp) records += db.multiplicity(s);
+            std::vector<iitii_node*> found = tree->query(n);
+            for (auto& s : found) {
+                if (s->l > n || s->r < n) {
+                    std::cerr << "implicit tree broken at " << n << std::endl;
+                }
+            }
+            if (found.size() != records) {
+                std::cerr << "implicit tree disagrees at " << n << std::endl;
+            }
+        }
     }
     std::cerr << std::endl;
     
@@ -22,7 +22,16 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include <vector>
 #include <list>
 #include <stack>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <unordered_set>
+#include <random>
 #include <limits>
+#include <stdexcept>
+#include <chrono>
+#include <functional>
 #include <algorithm>
 #include <cmath>
 #include <iostream>
@@ -40,6 +49,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include <cassert>
 #include "ips4o.hpp"
 #include "mmappable_vector.h"
+#include "storage.hpp"
 
 namespace intervalstab {
 
@@ -58,8 +68,12 @@ struct interval {
     ~interval<T>(void) { }
 };
 
+// a node of the stabbing forest, holding only what traversal reads
+// payloads are kept apart in a column indexed by node id, see faststabbing::value
 template <typename T>
-struct interval_node : interval<T> {
+struct interval_node {
+	uint64_t l = 0;
+    uint64_t r = 0;
 	interval_node<T>* leftsibling = nullptr;
 	interval_node<T>* rightchild = nullptr;
 	interval_node<T>* parent = nullptr;
@@ -80,6 +94,11 @@ inline bool operator==(const interval<T>& x,const interval<T>& y) {
 	return (x.l == y.l && x.r == y.r);
 }
 
+template <typename T>
+inline bool operator<(const interval_node<T>& x,const interval_node<T>& y) {
+	return (x.l < y.l || x.l == y.l && x.r > y.r);
+}
+
 // lexicographic order
 template <typename T>
 inline bool operator>(const interval<T>& x,const interval<T>& y) {
@@ -101,86 +120,318 @@ inline std::ostream& operator<<(std::ostream& os, const std::vector<interval_nod
 	return os;
 }
 
-template <typename T>
-void fill_file(const char *fname, const uint64_t& count) {
-    std::ofstream out(fname, std::ios_base::binary | std::ios::trunc);
-    T x;
-    for (uint64_t i=0; i<count; i++) {
-        out.write((char*)&x, sizeof(T));
+template <typename T, typename Storage = mmap_storage>
+class sweep_cursor;
+
+// a maximal run of positions [l, r] covered by the same number of intervals
+struct coverage_run {
+    uint64_t l = 0;
+    uint64_t r = 0;
+    uint64_t depth = 0;
+};
+
+// the size and shape of a built index, see faststabbing::stats
+// histograms marked log2 count in bucket k the values in [2^k, 2^(k+1))
+struct index_stats {
+    const char* backend = "";
+    uint64_t records = 0;
+    uint64_t nodes = 0;
+    uint64_t domain = 0; // bigN, the largest end
+    uint64_t coordinate_bits = 0; // bits needed for any coordinate
+    // bytes of what a query reads, and of what is built on demand
+    uint64_t node_bytes = 0;
+    uint64_t stop_bytes = 0; // the stop array or its runs
+    uint64_t value_bytes = 0;
+    uint64_t payload_offset_bytes = 0;
+    uint64_t on_demand_bytes = 0; // end order, reach and categories, if built
+    uint64_t total_bytes = 0;
+    // bytes of the transient build structures, and of everything alive at once at the worst point
+    uint64_t interval_bytes = 0;
+    uint64_t eventlist_bytes = 0;
+    uint64_t eventlist_layout_bytes = 0;
+    uint64_t sweep_list_bytes = 0; // the status list at its longest
+    uint64_t peak_build_bytes = 0;
+    // shape
+    std::vector<uint64_t> depth_histogram; // groups at each depth of the forest, roots at 0
+    std::vector<uint64_t> chain_histogram; // log2 of the nodes per group linked through smaller
+    std::vector<uint64_t> stop_run_histogram; // log2 of the runs of positions sharing a stop entry
+    uint64_t stop_runs = 0;
+    // per query, averaged over [1,bigN]
+    double mean_path = 0; // nodes pushed on the way up from stop[q]
+    double mean_stabbed = 0; // nodes reported
+    double expected_cost = 0; // nodes touched, each reported node can cost one more failed probe
+                              // for the sorted backend, the reported nodes plus the scan estimate
+};
+
+// write the stats as tab separated key value lines, histograms as space separated counts
+inline void write_stats(std::ostream& out, const index_stats& st) {
+    auto histogram = [&out](const char* key, const std::vector<uint64_t>& h) {
+        out << key << "\t";
+        for (uint64_t i = 0; i < h.size(); ++i) out << (i ? " " : "") << h[i];
+        out << "\n";
+    };
+    out << "backend\t" << st.backend << "\n"
+        << "records\t" << st.records << "\n"
+        << "nodes\t" << st.nodes << "\n"
+        << "domain\t" << st.domain << "\n"
+        << "coordinate_bits\t" << st.coordinate_bits << "\n"
+        << "node_bytes\t" << st.node_bytes << "\n"
+        << "stop_bytes\t" << st.stop_bytes << "\n"
+        << "value_bytes\t" << st.value_bytes << "\n"
+        << "payload_offset_bytes\t" << st.payload_offset_bytes << "\n"
+        << "on_demand_bytes\t" << st.on_demand_bytes << "\n"
+        << "total_bytes\t" << st.total_bytes << "\n"
+        << "interval_bytes\t" << st.interval_bytes << "\n"
+        << "eventlist_bytes\t" << st.eventlist_bytes << "\n"
+        << "eventlist_layout_bytes\t" << st.eventlist_layout_bytes << "\n"
+        << "sweep_list_bytes\t" << st.sweep_list_bytes << "\n"
+        << "peak_build_bytes\t" << st.peak_build_bytes << "\n";
+    histogram("depth_histogram", st.depth_histogram);
+    histogram("chain_histogram_log2", st.chain_histogram);
+    histogram("stop_run_histogram_log2", st.stop_run_histogram);
+    out << "stop_runs\t" << st.stop_runs << "\n"
+        << "mean_path\t" << st.mean_path << "\n"
+        << "mean_stabbed\t" << st.mean_stabbed << "\n"
+        << "expected_cost\t" << st.expected_cost << std::endl;
+}
+
+// a phase of the build, reported to the build observer as it ends
+struct build_phase {
+    const char* name = ""; // concat, sort, copy, layout, eventlist, sweep or cleanup
+    double seconds = 0;
+    uint64_t items = 0; // records, nodes or positions the phase went through
+    uint64_t bytes = 0; // bytes of the arrays it read or wrote, each pass counted once
+};
+
+typedef std::function<void(const build_phase&)> build_observer;
+
+// one JSON object per phase and line
+inline void write_build_phase_json(std::ostream& out, const build_phase& p) {
+    out << "{\"phase\":\"" << p.name << "\",\"seconds\":" << p.seconds
+        << ",\"items\":" << p.items << ",\"bytes\":" << p.bytes
+        << ",\"bytes_per_second\":" << (p.seconds > 0 ? p.bytes / p.seconds : 0) << "}" << std::endl;
+}
+
+// write the depth track as bedGraph (0-based, half-open)
+inline void write_bedgraph(std::ostream& out, const std::string& seq_name, const std::vector<coverage_run>& runs) {
+    for (auto& run : runs) {
+        out << seq_name << "\t" << run.l-1 << "\t" << run.r << "\t" << run.depth << "\n";
     }
+}
+
+// write the depth track as raw coverage_run records that can be mmapped back
+inline void write_coverage(const std::string& fname, const std::vector<coverage_run>& runs) {
+    std::ofstream out(fname.c_str(), std::ios_base::binary | std::ios::trunc);
+    if (out.fail()) {
+        throw std::ios_base::failure(std::strerror(errno));
+    }
+    out.write((char*)runs.data(), runs.size()*sizeof(coverage_run));
     out.close();
 }
-    
+
+// map a depth track written by write_coverage
+inline void mmap_coverage(const std::string& fname, mmappable_vector<coverage_run>& runs) {
+    struct stat stats;
+    if (-1 == stat(fname.c_str(), &stats)) {
+        throw std::ios_base::failure(std::strerror(errno));
+    }
+    assert(stats.st_size % sizeof(coverage_run) == 0);
+    runs.mmap_file(fname.c_str(), READ_ONLY, 0, stats.st_size / sizeof(coverage_run));
+}
+
+// how the kernel should page our mapped structures
+struct mmap_policy {
+    bool sequential_build = true; // read ahead aggressively during the build passes
+    bool random_queries = true;   // no readahead on the nodes and stop once indexed
+    bool huge_pages = false;      // back the nodes and stop with transparent huge pages where available
+    bool prewarm = false;         // fault in the query structures at the end of index()
+};
+
+// advise the kernel about [p, p+bytes), widened to whole pages
+// advice is only a hint, so failures are ignored
+inline void advise_range(const void* p, const size_t& bytes, const int& advice) {
+    if (p == nullptr || bytes == 0) return;
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t begin = (uintptr_t)p & ~(page-1);
+    uintptr_t end = (uintptr_t)p + bytes;
+    madvise((void*)begin, end - begin, advice);
+}
+
+// fault in every page of [p, p+bytes) so first queries do not stall on it
+inline void prewarm_range(const void* p, const size_t& bytes) {
+    if (p == nullptr || bytes == 0) return;
+#ifdef MADV_POPULATE_READ
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t begin = (uintptr_t)p & ~(page-1);
+    if (madvise((void*)begin, (uintptr_t)p + bytes - begin, MADV_POPULATE_READ) == 0) return;
+#endif
+    // older kernels: ask for readahead, then touch one byte per page
+    advise_range(p, bytes, MADV_WILLNEED);
+    size_t step = sysconf(_SC_PAGESIZE);
+    volatile const char* c = (const char*)p;
+    char sink = 0;
+    for (size_t i = 0; i < bytes; i += step) sink ^= c[i];
+    sink ^= c[bytes-1];
+    (void)sink;
+}
+
+template <typename V>
+void advise_vector(const V& v, const int& advice) {
+    if (!v.empty()) advise_range(v.data(), v.size()*sizeof(v[0]), advice);
+}
+
+template <typename V>
+void prewarm_vector(const V& v) {
+    if (!v.empty()) prewarm_range(v.data(), v.size()*sizeof(v[0]));
+}
+
+// call f(x) for every node of a stabbing forest stabbed at q, in query order,
+// starting from top, the stop entry for q
+template <typename T, typename F>
+void stab_from(interval_node<T>* top, const uint64_t& q, const F& f) {
+    if (top == nullptr) return; // no stabbed intervals
+    interval_node<T>* i;
+    interval_node<T>* temp;
+    std::deque<interval_node<T>*> process;
+    for (temp = top; temp->parent != nullptr; temp = temp->parent) {
+        process.push_front(temp);
+    }
+
+    // traverse
+    while (!process.empty()) {
+        i = process.back();
+        process.pop_back();
+        f(i);
+
+        temp = i->smaller;
+        while (temp != nullptr) {
+            if (q > temp->r) break;
+            f(temp);
+            temp = temp->smaller;
+        }
+
+        // go along rightmost path of pa
+        temp = i->leftsibling;
+        while (temp) {
+            if (temp->r < q) break;
+            process.push_back(temp);
+            temp = temp->rightchild;
+        }
+    }
+}
+
+// the same, with the forest given by its stop array over [0,bigN], so copies of it can be traversed too
+template <typename T, typename F>
+void stab_forest(interval_node<T>* const* stop, const uint64_t& bigN, const uint64_t& q, const F& f) {
+    if (q > bigN) return;
+    stab_from<T>(stop[q], q, f);
+}
+
+// how queries find the stabbed nodes
+enum stab_backend {
+    BACKEND_AUTO,      // chosen by index() from the dataset profile
+    BACKEND_FULL_STOP, // the forest with a stop entry for every position
+    BACKEND_STOP_RUNS, // the forest with stop kept as runs of equal entries, found by binary search
+    BACKEND_SORTED     // no forest, a backward scan of the start order bounded by the prefix max of ends
+};
+
+inline const char* backend_name(const stab_backend& b) {
+    switch (b) {
+    case BACKEND_FULL_STOP: return "full-stop";
+    case BACKEND_STOP_RUNS: return "stop-runs";
+    case BACKEND_SORTED: return "sorted";
+    default: return "auto";
+    }
+}
+
+inline stab_backend parse_backend(const std::string& name) {
+    if (name == "auto") return BACKEND_AUTO;
+    if (name == "full-stop") return BACKEND_FULL_STOP;
+    if (name == "stop-runs") return BACKEND_STOP_RUNS;
+    if (name == "sorted") return BACKEND_SORTED;
+    throw std::invalid_argument("unknown backend " + name + ", expected auto, full-stop, stop-runs or sorted");
+}
+
+// what index() learns about the data in passes it makes anyway, to choose a backend
+struct dataset_profile {
+    uint64_t records = 0;
+    uint64_t nodes = 0;
+    uint64_t domain = 0; // bigN
+    double density = 0; // nodes per position
+    uint64_t median_length = 0; // of a sample of up to 4096 nodes spread over the start order
+    uint64_t p99_length = 0;
+    double duplicate_rate = 0; // records repeating the interval before them
+    double scan_estimate = 0; // nodes a sorted scan passes over that end before the query, at sampled positions
+};
+
+/// the backend for a profile, for nodes of node_bytes each
+/// a stop entry per position is used while it is no bigger than the nodes themselves; past that,
+/// the sorted scan if it passes over few nodes, else the forest with its stop array as runs,
+/// which are at most 2n+1. tiny sets are always scanned.
+inline stab_backend choose_backend(const dataset_profile& p, const uint64_t& node_bytes) {
+    if (p.nodes <= 64) return BACKEND_SORTED;
+    if ((p.domain + 1) * sizeof(void*) <= p.nodes * node_bytes) return BACKEND_FULL_STOP;
+    if (p.scan_estimate <= 8) return BACKEND_SORTED;
+    return BACKEND_STOP_RUNS;
+}
+
 // fast stabbing
 //template <typename interval> // TODO
-template <typename T>
+template <typename T, typename Storage = mmap_storage>
 class faststabbing
 {
 private:
 
-    int get_thread_count(void) {
-        int thread_count = 1;
-#pragma omp parallel
-        {
-#pragma omp master
-            thread_count = omp_get_num_threads();
-        }
-        return thread_count;
-    }
+    template <typename X>
+    using array = typename Storage::template array<X>;
 
-    std::ofstream writer;
-    std::vector<std::ofstream> writers;
-    char* reader = nullptr;
-    int reader_fd = 0;
+    typename Storage::template spool<interval<T>> input; // intervals added before index()
+    std::atomic<uint64_t> pending{0}; // how many of them
     std::string filename;
     bool sorted = false;
+    bool collapse_duplicates = false;
+    mmap_policy policy;
     // key information
     uint64_t n_records = 0;
-    bool indexed = false;
-    uint32_t OUTPUT_VERSION = 1; // update as we change our format
+    // recorded by the build for stats()
+    uint64_t build_interval_bytes = 0;
+    uint64_t build_eventlist_bytes = 0;
+    uint64_t build_eventlist_layout_bytes = 0;
+    uint64_t build_sweep_peak = 0; // longest status list
+    uint64_t build_peak_bytes = 0;
+    uint64_t sweep_chunks = 0; // domain chunks swept in parallel, 0 for several per thread
+    stab_backend requested_backend = BACKEND_AUTO;
+    stab_backend chosen_backend = BACKEND_FULL_STOP;
+    dataset_profile profile;
+    build_observer observer; // told about each build phase, nothing by default
+    std::chrono::steady_clock::time_point phase_start;
 
-public:
-
-    void set_base_filename(const std::string& f) {
-        filename = f;
-    }
-
-    // close/open backing file
-    void open_main_writer(void) {
-        if (writer.is_open()) {
-            writer.seekp(0, std::ios_base::end); // seek to the end for appending
-            return;
-        }
-        assert(!intervals_filename().empty());
-        writer.open(intervals_filename().c_str(), std::ios::binary | std::ios::trunc);
-        if (writer.fail()) {
-            throw std::ios_base::failure(std::strerror(errno));
+    void phase_done(const char* name, const uint64_t& items, const uint64_t& touched) {
+        auto now = std::chrono::steady_clock::now();
+        if (observer) {
+            build_phase p;
+            p.name = name;
+            p.seconds = std::chrono::duration<double>(now - phase_start).count();
+            p.items = items;
+            p.bytes = touched;
+            observer(p);
         }
+        phase_start = now;
     }
 
-    // per-thread writers
-    void open_writers(const std::string& f) {
-        set_base_filename(f);
-        open_writers();
+    template <typename X>
+    static uint64_t bytes(const array<X>& v) {
+        return v.size() * sizeof(X);
     }
+    bool indexed = false;
+    uint32_t OUTPUT_VERSION = 1; // update as we change our format
 
-    void open_writers(void) {
-        assert(!filename.empty());
-        writers.clear();
-        writers.resize(get_thread_count());
-        for (size_t i = 0; i < writers.size(); ++i) {
-            auto& writer = writers[i];
-            writer.open(writer_filename(i), std::ios::binary | std::ios::app);
-            if (writer.fail()) {
-                throw std::ios_base::failure(std::strerror(errno));
-            }
-        }
-    }
+public:
 
-    std::string writer_filename(size_t i) {
-        std::stringstream wf;
-        wf << filename << ".tmp_write" << "." << i;
-        return wf.str();
+    typedef interval<T> interval_type;
+
+    void set_base_filename(const std::string& f) {
+        filename = f;
     }
 
     std::string intervals_filename(void) {
@@ -203,211 +454,122 @@ public:
         return filename + ".stop";
     }
 
-    std::ofstream& get_writer(void) {
-        return writers[omp_get_thread_num()];
+    std::string values_filename(void) {
+        return filename + ".values";
     }
 
-    void sync_and_close_parallel_writers(void) {
-        // check to see if we ran single-threaded
-        uint64_t used_writers = 0;
-        uint64_t writer_that_wrote = 0;
-        for (size_t i = 0; i < writers.size(); ++i) {
-            writers[i].close();
-            if (filesize(writer_filename(i).c_str())) {
-                ++used_writers;
-                writer_that_wrote = i;
-            }
-        }
-        bool single_threaded = used_writers == 1;
-        // close the temp writers and cat them onto the end of the main file
-        if (single_threaded) {
-            std::rename(writer_filename(writer_that_wrote).c_str(), intervals_filename().c_str());
-        } else {
-            open_main_writer();
-            for (size_t i = 0; i < writers.size(); ++i) {
-                std::ifstream if_w(writer_filename(i), std::ios_base::binary);
-                writer << if_w.rdbuf();
-                if_w.close();
-                std::remove(writer_filename(i).c_str());
-            }
-        }
-        writers.clear();
-        writer.close();
-        for (size_t i = 0; i < writers.size(); ++i) {
-            std::remove(writer_filename(i).c_str());
-        }
+    std::string payload_offsets_filename(void) {
+        return filename + ".payload_offsets";
     }
 
-    /// return the number of records, which will only work after indexing
-    size_t size(void) const {
-        return n_records;
+    std::string ends_filename(void) {
+        return filename + ".ends";
     }
 
-    /// return the backing buffer
-    char* get_buffer(void) const {
-        return reader;
+    std::string ends_layout_filename(void) {
+        return filename + ".ends.layout";
     }
 
-    /// get the record count
-    size_t record_count(void) {
-        int fd = open(intervals_filename().c_str(), O_RDWR);
-        if (fd == -1) {
-            assert(false);
-        }
-        struct stat stats;
-        if (-1 == fstat(fd, &stats)) {
-            assert(false);
-        }
-        assert(stats.st_size % sizeof(interval<T>) == 0); // must be even records
-        size_t count = stats.st_size / sizeof(interval<T>);
-        close(fd);
-        return count;
+    std::string reach_filename(void) {
+        return filename + ".reach";
+    }
+
+    std::string stop_run_starts_filename(void) {
+        return filename + ".stop.runs";
+    }
+
+    std::string stop_run_nodes_filename(void) {
+        return filename + ".stop.nodes";
     }
 
-    std::ifstream::pos_type filesize(const char* filename) {
-        std::ifstream in(filename, std::ifstream::ate | std::ifstream::binary);
-        return in.tellg(); 
+    std::string categories_filename(void) {
+        return filename + ".categories";
     }
 
-    mmappable_vector<interval<T>> intervals; // array of intervals [0,n-1]
-    mmappable_vector<interval_node<T>> a; // array of interval contexts [0,n-1]
+    /// return the number of records, which will only work after indexing
+    size_t size(void) const {
+        return n_records;
+    }
+
+    array<interval<T>> intervals; // array of intervals [0,n-1]
+    array<interval_node<T>> a; // array of interval contexts [0,n-1]
 	uint64_t n,bigN;
-    mmappable_vector<interval_node<T>*> eventlist;
-    mmappable_vector<uint64_t> eventlist_layout;
+    array<interval_node<T>*> eventlist;
+    array<uint64_t> eventlist_layout;
     //lciv_iv eventlist;
     //suc_bv eventlist_delim;
 
-    mmappable_vector<interval_node<T>*> stop;
+    array<interval_node<T>*> stop;
+    array<uint64_t> stop_run_starts; // for stop runs, the first position of each run
+    array<interval_node<T>*> stop_run_nodes; // and its entry
 	interval_node<T> dummy;
+    array<T> values; // payloads of all intervals in node order
+    array<uint64_t> payload_offsets; // start of each node's run in values, if collapsing
+    array<interval_node<T>*> ends; // nodes ordered by end point, built on demand
+    std::once_flag ends_built;
+    array<uint64_t> reach; // largest end among the nodes up to each one in start order, built on demand
+    std::once_flag reach_built;
+    array<uint64_t> categories; // one bitmap over the node ids per category
+    uint64_t category_count = 0;
+    uint64_t category_words = 0;
 
-    void preprocessing(void) {
-        // calculate numberDomain, numberIntervals, n, and bigN
-        // sync the writers and mmap the file into our vector
-        sync_and_close_parallel_writers();
-        intervals.mmap_file(intervals_filename().c_str(), READ_WRITE_SHARED, 0, record_count());
-        n = record_count(); // number of intervals
-        ips4o::parallel::sort(intervals.begin(), intervals.end()); // sort the intervals
-        uint64_t domain_count = 0; // find the domain of our integer space
-        for (auto& i : intervals) { if (i.r > domain_count) domain_count = i.r; }
-        bigN = domain_count; // number of domains
-        //std::cerr << "bigN = " << bigN << std::endl;
-        fill_file<interval_node<T>>(node_filename().c_str(), n);
-        a.mmap_file(node_filename().c_str(), READ_WRITE_SHARED, 0, n);
-        // copy intervals into our stabbing tree
-        for (uint64_t i = 0; i < n; ++i) {
-            auto& o = intervals[i];
-            a[i].l = o.l;
-            a[i].r = o.r;
-            a[i].value = o.value;
-        }
-        // clean up intervals file
-        intervals.munmap_file();
-        std::remove(intervals_filename().c_str());
-        // mmap our sweepline and stop
-        fill_file<interval_node<T>*>(stop_filename().c_str(), bigN+1);
-        stop.mmap_file(stop_filename().c_str(), READ_WRITE_SHARED, 0, bigN+1);
-        for (auto& i : stop) { i = nullptr; }
-        // mmap our eventlist
-        uint64_t eventlist_size = 0;
-        uint64_t l=0,starting=-1;
-        for (uint64_t i=0; i<n; ++i) {
-            l = a[i].l;
-            if (l != starting) {
-                eventlist_size += 2;
-            }
-            starting = l;
-        }
-
-        fill_file<interval_node<T>*>(eventlist_filename().c_str(), eventlist_size);
-        eventlist.mmap_file(eventlist_filename().c_str(), READ_WRITE_SHARED, 0, eventlist_size);
-        for (uint64_t i=0; i<eventlist_size; ++i) {
-            eventlist[i] = nullptr;
-        }
-
-        fill_file<uint64_t>(eventlist_layout_filename().c_str(), bigN+2);
-        eventlist_layout.mmap_file(eventlist_layout_filename().c_str(), READ_WRITE_SHARED, 0, bigN+2);
-        for (uint64_t i=0; i<bigN+2; ++i) {
-            eventlist_layout[i] = 0;
+    void build_end_order(void) {
+        if (n == 0) return;
+        if (chosen_backend != BACKEND_FULL_STOP) {
+            // without a per-position array a bigN layout would undo the point of the backend,
+            // so compare instead, with ties broken by node address to stay in start order
+            ends.allocate(ends_filename(), n);
+            for (uint64_t i = 0; i < n; ++i) ends[i] = &a[i];
+            ips4o::parallel::sort(ends.begin(), ends.end(),
+                                  [](const interval_node<T>* x, const interval_node<T>* y) {
+                                      return x->r < y->r || x->r == y->r && x < y; });
+            return;
         }
-
-        // determine the layout, using our eventlist_layout to temporarily store the counts
-        l=0; starting=-1;
-        for (uint64_t i=0; i<n; ++i) {
-            l = a[i].l;
-            if (l != starting) {
-                ++eventlist_layout[a[i].r];
-                ++eventlist_layout[l];
-            } else {
-                assert(a[i-1].l == l && a[i-1].r >= a[i].r);
-                a[i-1].smaller = &a[i];
-            }
-            starting = l;
+        // counting sort of the nodes by their end point, stable in start order
+        array<uint64_t> ends_layout;
+        ends_layout.allocate(ends_layout_filename(), bigN+2);
+        for (auto& i : ends_layout) { i = 0; }
+        for (uint64_t i = 0; i < n; ++i) {
+            ++ends_layout[a[i].r];
         }
-        // record the layout offsets in the eventlist_layout
         uint64_t offset = 0;
-        for (uint64_t i=1; i<=bigN+1; ++i) {
-            uint64_t count = eventlist_layout[i];
-            //std::cerr << "count at " << i << " = " << count << std::endl;
-            eventlist_layout[i] = offset;
+        for (uint64_t i = 0; i <= bigN+1; ++i) {
+            uint64_t count = ends_layout[i];
+            ends_layout[i] = offset;
             offset += count;
-            //std::cerr << "eventlist_layout " << i << " -> " << offset << std::endl;
         }
-        std::cerr << "eventlist size " << eventlist.size() << std::endl;
-        // build our data structures
-        l=0; starting=-1;
-        for (uint64_t i=0; i<n; ++i) {
-            if (i % 1000 == 0) {
-                std::cerr << "eventlist " << i << "\r";
-            }
-            l = a[i].l;
-            //std::cerr << "processing " << a[i] << std::endl;
-            if (l != starting) {
-                // sorted event lists for sweepline
-                // find were to insert
-                uint64_t write_at = eventlist_layout[a[i].r];
-                //std::cerr << "write at for r " << write_at << std::endl;
-                while (eventlist[write_at] != nullptr) ++write_at;
-                eventlist[write_at] = &a[i];
-                write_at = eventlist_layout[l];
-                //std::cerr << "write at for l " << write_at << std::endl;
-                while (eventlist[write_at] != nullptr) ++write_at;
-                eventlist[write_at] = &a[i];
-            } else {
-                assert(a[i-1].l == l && a[i-1].r >= a[i].r);
-                a[i-1].smaller = &a[i];
-            }
-            starting = l;
+        ends.allocate(ends_filename(), n);
+        for (uint64_t i = 0; i < n; ++i) {
+            ends[ends_layout[a[i].r]++] = &a[i];
         }
-        std::cerr << std::endl;
+        ends_layout.release();
+    }
 
-        // sweep line
+    void build_reach(void) {
+        reach.allocate(reach_filename(), n);
+        uint64_t r = 0;
+        for (uint64_t i = 0; i < n; ++i) {
+            r = std::max(r, a[i].r);
+            reach[i] = r;
+        }
+    }
+
+    // link each group head to the open head before it when it ends, and point stop at the last open head
+    void sweep(void) {
         std::list<interval_node<T>*> L; // status list
         interval_node<T>* temp;
         interval_node<T>* last;
+        uint64_t next_start = 0;
+        build_sweep_peak = 0;
         for (uint64_t i=1; i<=bigN; ++i) {
-            //for (uint64_t i=1; i<=bigN; ++i) {
-            if (i % 1000 == 0) {
-                std::cerr << "building " << i << "\r";
-            }
             // interval with starting point i
-            //uint64_t x = eventlist_delim.select1(i-1)+1;
-            //uint64_t y = eventlist_delim.select1(i);
-            uint64_t x = eventlist_layout[i];
-            uint64_t y = eventlist_layout[i+1];
-            if (y - x > 0) {
-                //std::cerr << "eventlist size " << y - x << std::endl;
-                //temp = eventlist[i].back();
-                //temp = &a[eventlist.at(x)];
-                uint64_t read_at = y-1;
-                while (read_at != x-1 && eventlist[read_at] == nullptr) --read_at;
-                if (read_at != x-1) {
-                    temp = eventlist[read_at];
-                    if (temp->l == i) {
-                        L.push_back(temp);
-                        temp->pIt = std::prev(L.end());
-                        eventlist[read_at] = nullptr;
-                    }
-                }
+            if (next_start < n && a[next_start].l == i) {
+                temp = &a[next_start];
+                L.push_back(temp);
+                temp->pIt = std::prev(L.end());
+                build_sweep_peak = std::max(build_sweep_peak, (uint64_t)L.size());
+                // skip the rest of its group, they are reached through smaller
+                while (next_start < n && a[next_start].l == i) ++next_start;
             }
             /*
             std::cerr << "sweeep " << i << ": " << eventlist[i];
@@ -418,15 +580,11 @@ public:
             if (!L.empty()) {
                 // compute stop[i]
                 stop[i] = L.back();
-                // intervals with end points i
-                uint64_t x = eventlist_layout[i];
-                uint64_t y = eventlist_layout[i+1];
+                // intervals with end points i, latest start first
+                uint64_t x = eventlist_layout[i-1];
+                uint64_t y = eventlist_layout[i];
                 if (y - x > 0) {
-                    uint64_t read_at = y-1;
-                    while (read_at != x-1 && eventlist[read_at] == nullptr) --read_at;
-                    //if (read_at == x-1) last = &dummy;
-                    //std::cerr << "read_at = " << read_at << std::endl;
-                    for (uint64_t j = read_at; j != x-1; --j) {
+                    for (uint64_t j = y-1; j != x-1; --j) {
                         //std::cerr << "looking at eventlist " << j << std::endl;
                         temp = eventlist[j];
                         //std::cerr << "temp " << temp << std::endl;
@@ -446,19 +604,355 @@ public:
                 }
             }
         }
-        std::cerr << std::endl;
+    }
+
+    // a step of a chunk's sweep that depends on intervals opened in earlier chunks
+    struct deferred_step {
+        bool end = false; // an end of node, else a run of stop entries [from, to]
+        uint64_t from = 0;
+        uint64_t to = 0;
+        interval_node<T>* node = nullptr; // for a stop run, the entry once resolved
+    };
+
+    // the sweep with the domain cut into chunks swept in parallel
+    // a chunk starts without knowing which heads are still open from earlier chunks, so it links
+    // what it can with its own open heads and defers the ends and stop entries that need the
+    // others. a sequential pass then replays the deferred steps of each chunk in order over the
+    // heads carried in, and the stop runs they resolve are filled in parallel. every link and
+    // stop entry comes out as the sequential sweep makes it.
+    void parallel_sweep(const uint64_t& chunk_count) {
+        uint64_t chunk_size = bigN / chunk_count + 1;
+        std::vector<std::list<interval_node<T>*>> open(chunk_count); // heads still open at each chunk end
+        std::vector<std::vector<deferred_step>> deferred(chunk_count);
+        std::vector<uint64_t> open_peak(chunk_count, 0);
+#pragma omp parallel for schedule(dynamic, 1)
+        for (uint64_t c = 0; c < chunk_count; ++c) {
+            uint64_t begin = 1 + c * chunk_size;
+            uint64_t last_position = std::min(bigN, begin + chunk_size - 1);
+            auto& L = open[c];
+            auto& steps = deferred[c];
+            uint64_t next_start = std::lower_bound(a.begin(), a.end(), begin,
+                                                   [](const interval_node<T>& x, const uint64_t& p) {
+                                                       return x.l < p; }) - a.begin();
+            for (uint64_t i = begin; i <= last_position; ++i) {
+                if (next_start < n && a[next_start].l == i) {
+                    interval_node<T>* temp = &a[next_start];
+                    L.push_back(temp);
+                    temp->pIt = std::prev(L.end());
+                    open_peak[c] = std::max(open_peak[c], (uint64_t)L.size());
+                    while (next_start < n && a[next_start].l == i) ++next_start;
+                }
+                if (!L.empty()) {
+                    stop[i] = L.back();
+                } else if (!steps.empty() && !steps.back().end && steps.back().to + 1 == i) {
+                    steps.back().to = i;
+                } else {
+                    steps.push_back(deferred_step());
+                    steps.back().from = steps.back().to = i;
+                }
+                // ends, latest start first
+                uint64_t x = eventlist_layout[i-1];
+                uint64_t y = eventlist_layout[i];
+                for (uint64_t j = y; j > x; --j) {
+                    interval_node<T>* temp = eventlist[j-1];
+                    bool local = temp->l >= begin;
+                    if (local && temp->pIt != L.begin()) {
+                        interval_node<T>* last = *std::prev(temp->pIt);
+                        temp->parent = last;
+                        temp->leftsibling = last->rightchild;
+                        last->rightchild = temp;
+                        L.erase(temp->pIt);
+                    } else {
+                        // its parent was opened in an earlier chunk, if at all
+                        if (local) L.erase(temp->pIt);
+                        steps.push_back(deferred_step());
+                        steps.back().end = true;
+                        steps.back().from = steps.back().to = i;
+                        steps.back().node = temp;
+                    }
+                }
+            }
+        }
+        // replay in chunk order over the heads carried in, which precede every head of the chunk
+        std::list<interval_node<T>*> carried;
+        build_sweep_peak = 0;
+        for (uint64_t c = 0; c < chunk_count; ++c) {
+            uint64_t begin = 1 + c * chunk_size;
+            build_sweep_peak = std::max(build_sweep_peak, carried.size() + open_peak[c]); // at most
+            for (auto& step : deferred[c]) {
+                if (!step.end) {
+                    step.node = carried.empty() ? nullptr : carried.back();
+                    continue;
+                }
+                interval_node<T>* temp = step.node;
+                interval_node<T>* last;
+                if (temp->l < begin) {
+                    last = temp->pIt != carried.begin() ? *std::prev(temp->pIt) : &dummy;
+                    carried.erase(temp->pIt);
+                } else {
+                    last = carried.empty() ? &dummy : carried.back();
+                }
+                temp->parent = last;
+                temp->leftsibling = last->rightchild;
+                last->rightchild = temp;
+            }
+            // splicing keeps the list positions of the heads valid
+            carried.splice(carried.end(), open[c]);
+        }
+#pragma omp parallel for schedule(dynamic, 1)
+        for (uint64_t c = 0; c < chunk_count; ++c) {
+            for (auto& step : deferred[c]) {
+                if (step.end || step.node == nullptr) continue;
+                for (uint64_t i = step.from; i <= step.to; ++i) stop[i] = step.node;
+            }
+        }
+    }
+
+    // what the backend choice looks at, from the sorted intervals
+    void profile_dataset(const uint64_t& distinct) {
+        profile = dataset_profile();
+        profile.records = n_records;
+        profile.nodes = n;
+        profile.domain = bigN;
+        profile.density = bigN ? (double)n / bigN : 0;
+        profile.duplicate_rate = n_records ? 1 - (double)distinct / n_records : 0;
+        std::vector<uint64_t> lengths;
+        uint64_t samples = std::min(n_records, (uint64_t)4096);
+        for (uint64_t k = 0; k < samples; ++k) {
+            auto& o = intervals[k * n_records / samples];
+            lengths.push_back(o.r - o.l + 1);
+        }
+        if (!lengths.empty()) {
+            std::nth_element(lengths.begin(), lengths.begin() + lengths.size() / 2, lengths.end());
+            profile.median_length = lengths[lengths.size() / 2];
+            std::nth_element(lengths.begin(), lengths.begin() + lengths.size() * 99 / 100, lengths.end());
+            profile.p99_length = lengths[lengths.size() * 99 / 100];
+        }
+        // the sorted scan at q walks the nodes starting at or before q back to the first whose
+        // prefix max of ends reaches q, so one long interval early on makes it walk nearly all of
+        // them. both bounds are monotone in q, so one pass over the nodes finds them for a sorted
+        // grid of sample positions.
+        uint64_t positions = std::min(bigN, (uint64_t)4096);
+        if (positions == 0) return;
+        std::vector<uint64_t> qs(positions);
+        for (uint64_t k = 0; k < positions; ++k) qs[k] = 1 + k * bigN / positions;
+        std::vector<uint64_t> first_reaching(positions, n); // nodes before the scan stops
+        std::vector<uint64_t> started(positions, n); // nodes starting at or before q
+        uint64_t running = 0;
+        uint64_t next_reach = 0, next_start = 0;
+        double stabbed = 0;
+        for (uint64_t i = 0, j = 0; i < n_records; ++i) {
+            auto& o = intervals[i];
+            if (collapse_duplicates && i > 0 && o == intervals[i-1]) continue;
+            while (next_start < positions && qs[next_start] < o.l) started[next_start++] = j;
+            running = std::max(running, o.r);
+            while (next_reach < positions && qs[next_reach] <= running) first_reaching[next_reach++] = j;
+            stabbed += o.r - o.l + 1;
+            ++j;
+        }
+        double walked = 0;
+        for (uint64_t k = 0; k < positions; ++k) {
+            if (started[k] > first_reaching[k]) walked += started[k] - first_reaching[k];
+        }
+        profile.scan_estimate = std::max(0.0, walked / positions - stabbed / bigN);
+    }
+
+    // the eventlist, the sweep, and for stop runs the compression of stop
+    void build_forest(uint64_t resident, const uint64_t& eventlist_size) {
+        // mmap our sweepline and stop
+        stop.allocate(stop_filename(), bigN+1);
+        if (policy.sequential_build) advise_vector(stop, MADV_SEQUENTIAL);
+        for (auto& i : stop) { i = nullptr; }
+        // record the start of each bucket, then fill them in node order
+        uint64_t offset = 0;
+        for (auto& i : eventlist_layout) {
+            uint64_t count = i;
+            i = offset;
+            offset += count;
+        }
+        phase_done("layout", bigN, bytes(stop) + bytes(eventlist_layout));
+        eventlist.allocate(eventlist_filename(), eventlist_size);
+        build_eventlist_bytes = bytes(eventlist);
+        resident += bytes(stop) + bytes(eventlist);
+        for (uint64_t i=0; i<n; ++i) {
+            if (i == 0 || a[i-1].l != a[i].l) {
+                eventlist[eventlist_layout[a[i].r]++] = &a[i];
+            }
+        }
+        // now bucket i is [eventlist_layout[i-1], eventlist_layout[i])
+        phase_done("eventlist", n, bytes(a) + bytes(eventlist) + bytes(eventlist_layout));
+
+        // sweep line, over chunks of the domain in parallel unless asked for one
+        uint64_t chunk_count = sweep_chunks ? sweep_chunks : 4 * get_thread_count();
+        if (chunk_count <= 1) {
+            sweep();
+        } else {
+            parallel_sweep(chunk_count);
+        }
+
+        // a list node holds the pointer and two links
+        build_peak_bytes = std::max(build_peak_bytes, resident + build_sweep_peak * 3 * sizeof(void*));
+        phase_done("sweep", bigN, bytes(a) + bytes(stop) + bytes(eventlist) + bytes(eventlist_layout));
+        eventlist.release();
+        eventlist_layout.release();
+        if (chosen_backend == BACKEND_STOP_RUNS) compress_stop();
+    }
+
+    // keep only the runs of equal stop entries
+    void compress_stop(void) {
+        uint64_t runs = 0;
+        for_each_stop_run([&runs](const uint64_t&, const uint64_t&, interval_node<T>*) { ++runs; });
+        stop_run_starts.allocate(stop_run_starts_filename(), runs);
+        stop_run_nodes.allocate(stop_run_nodes_filename(), runs);
+        uint64_t k = 0;
+        for_each_stop_run([this, &k](const uint64_t& from, const uint64_t&, interval_node<T>* x) {
+                stop_run_starts[k] = from;
+                stop_run_nodes[k] = x;
+                ++k;
+            });
+        phase_done("compress", bigN, bytes(stop) + bytes(stop_run_starts) + bytes(stop_run_nodes));
+        stop.release();
+    }
+
+    // the stop entry for q under either forest backend
+    interval_node<T>* stop_at(const uint64_t& q) const {
+        if (q > bigN) return nullptr;
+        if (!stop.empty()) return stop[q];
+        if (stop_run_starts.empty() || q < stop_run_starts[0]) return nullptr;
+        uint64_t k = std::upper_bound(stop_run_starts.begin(), stop_run_starts.end(), q) - stop_run_starts.begin();
+        return stop_run_nodes[k-1];
+    }
+
+    // the sorted backend: groups in decreasing start, each from its longest node while they reach q,
+    // until the prefix max of ends says nothing earlier does
+    template <typename F>
+    void scan_sorted(const uint64_t& q, const F& f) {
+        uint64_t i = std::upper_bound(a.begin(), a.end(), q,
+                                      [](const uint64_t& p, const interval_node<T>& x) {
+                                          return p < x.l; }) - a.begin();
+        while (i > 0 && reach[i-1] >= q) {
+            uint64_t g = i - 1;
+            while (g > 0 && a[g-1].l == a[i-1].l) --g;
+            for (interval_node<T>* x = &a[g]; x != nullptr && x->r >= q; x = x->smaller) f(x);
+            i = g;
+        }
+    }
 
-        eventlist.munmap_file();
-        std::remove(eventlist_filename().c_str());
-        eventlist_layout.munmap_file();
-        std::remove(eventlist_layout_filename().c_str());
+    void preprocessing(void) {
+        // calculate numberDomain, numberIntervals, n, and bigN
+        // sync the writers and mmap the file into our vector
+        phase_start = std::chrono::steady_clock::now();
+        input.finish(intervals, intervals_filename());
+        pending = 0;
+        indexed = true;
+        n_records = intervals.size(); // number of intervals
+        phase_done("concat", n_records, bytes(intervals));
+        if (policy.sequential_build) advise_vector(intervals, MADV_SEQUENTIAL);
+        // find the domain of our integer space, checking the order on the way
+        uint64_t domain_count = 0;
+        bool in_order = true;
+        for (uint64_t i = 0; i < n_records; ++i) {
+            auto& o = intervals[i];
+            if (o.r > domain_count) domain_count = o.r;
+            if (i > 0 && o < intervals[i-1]) in_order = false;
+        }
+        if (!in_order) {
+            if (sorted) {
+                throw std::runtime_error(intervals_filename() + ": input declared sorted is out of order");
+            }
+            ips4o::parallel::sort(intervals.begin(), intervals.end()); // sort the intervals
+        }
+        phase_done("sort", n_records, bytes(intervals) * (in_order ? 1 : 3));
+        bigN = domain_count; // number of domains
+        // one node per distinct interval if collapsing, with the payloads of its copies in a run
+        uint64_t distinct = 0;
+        for (uint64_t i = 0; i < n_records; ++i) {
+            if (i == 0 || !(intervals[i] == intervals[i-1])) ++distinct;
+        }
+        n = collapse_duplicates ? distinct : n_records; // number of nodes
+        profile_dataset(distinct);
+        chosen_backend = requested_backend == BACKEND_AUTO
+            ? choose_backend(profile, sizeof(interval_node<T>)) : requested_backend;
+        bool forest = chosen_backend != BACKEND_SORTED;
+        if (collapse_duplicates) {
+            payload_offsets.allocate(payload_offsets_filename(), n+1);
+        }
+        values.allocate(values_filename(), n_records);
+        a.allocate(node_filename(), n);
+        if (policy.sequential_build) advise_vector(a, MADV_SEQUENTIAL);
+        // the eventlist holds only the end events, bucketed by end point
+        // start events are read off the node array, which is in start order
+        if (forest) {
+            eventlist_layout.allocate(eventlist_layout_filename(), bigN+2);
+            for (auto& i : eventlist_layout) { i = 0; }
+        }
+        uint64_t eventlist_size = 0;
+        // copy intervals into our stabbing tree, linking each node to the next smaller one with its start
+        for (uint64_t i = 0, j = 0; i < n_records; ++i) {
+            auto& o = intervals[i];
+            values[i] = o.value;
+            if (collapse_duplicates) {
+                if (i > 0 && o == intervals[i-1]) continue;
+                payload_offsets[j] = i;
+            }
+            a[j].l = o.l;
+            a[j].r = o.r;
+            if (j > 0 && a[j-1].l == o.l) {
+                a[j-1].smaller = &a[j];
+            } else if (forest) {
+                ++eventlist_layout[o.r];
+                ++eventlist_size;
+            }
+            ++j;
+        }
+        if (collapse_duplicates) {
+            payload_offsets[n] = n_records;
+        }
+        build_interval_bytes = bytes(intervals);
+        build_eventlist_layout_bytes = bytes(eventlist_layout);
+        build_eventlist_bytes = 0;
+        build_sweep_peak = 0;
+        uint64_t resident = bytes(a) + bytes(values) + bytes(payload_offsets) + bytes(eventlist_layout);
+        build_peak_bytes = resident + build_interval_bytes;
+        phase_done("copy", n_records, resident + build_interval_bytes);
+        // clean up intervals file
+        intervals.release();
+        if (forest) {
+            build_forest(resident, eventlist_size);
+        } else {
+            // the sorted scan stops once nothing before it reaches the query
+            std::call_once(reach_built, [this](void) { build_reach(); });
+        }
+        apply_query_policy();
+        phase_done("cleanup", 0, policy.prewarm
+                   ? bytes(a) + bytes(stop) + bytes(stop_run_starts) + bytes(stop_run_nodes)
+                   + bytes(values) + bytes(payload_offsets) + bytes(reach) : 0);
 //#ifdef INTERVALSTAB_DEBUG
         //std::cerr << "\nDummy\t\t" << &dummy << "\n" << a.size() << std::endl;
 //#endi
     }
 
+    // switch the structures queries touch from build to query paging
+    void apply_query_policy(void) {
+        int advice = policy.random_queries ? MADV_RANDOM : MADV_NORMAL;
+        advise_vector(a, advice);
+        advise_vector(stop, advice);
+        advise_vector(stop_run_starts, advice);
+        advise_vector(stop_run_nodes, advice);
+        advise_vector(reach, advice);
+        advise_vector(values, advice);
+        advise_vector(payload_offsets, advice);
+#ifdef MADV_HUGEPAGE
+        if (policy.huge_pages) {
+            advise_vector(a, MADV_HUGEPAGE);
+            advise_vector(stop, MADV_HUGEPAGE);
+        }
+#endif
+        if (policy.prewarm) prewarm();
+    }
+
 //#ifdef INTERVALSTAB_DEBUG
-    bool verify(mmappable_vector<interval_node<T>*> output, const uint64_t& q) {
+    bool verify(std::vector<interval_node<T>*> output, const uint64_t& q) {
 //	cout << "\nQuery q=" << q << ":\n" << output;
         interval_node<T>* temp;
         interval_node<T>* last = nullptr;
@@ -486,69 +980,581 @@ public:
 //#endif
 
 public:
-	faststabbing(const std::string& f)
+    /// f is the base name of the index files, which anonymous storage does without
+	faststabbing(const std::string& f = std::string())
         : filename(f) {
 		dummy.parent = nullptr;
 		dummy.leftsibling = nullptr;
 		dummy.rightchild = nullptr;
-        open_writers(f);
+        input.open(f);
 	};
 
-    ~faststabbing(void) {
-        a.munmap_file();
-        std::remove(node_filename().c_str());
-        stop.munmap_file();
-        std::remove(stop_filename().c_str());
+    /// store identical intervals as one node with a run of payloads, must be set before index()
+    void set_collapse_duplicates(const bool& collapse) {
+        collapse_duplicates = collapse;
+    }
+
+    /// the position of a node in the sorted node array
+    uint64_t node_id(const interval_node<T>* x) const {
+        return x - &a[0];
+    }
+
+    /// how many input intervals a node stands for
+    uint64_t multiplicity(const interval_node<T>* x) const {
+        if (!collapse_duplicates) return 1;
+        uint64_t i = node_id(x);
+        return payload_offsets[i+1] - payload_offsets[i];
+    }
+
+    /// the payloads of the input intervals a node stands for, as [first, second)
+    std::pair<const T*, const T*> payloads(const interval_node<T>* x) const {
+        uint64_t i = node_id(x);
+        if (!collapse_duplicates) return std::make_pair(values.data() + i, values.data() + i + 1);
+        return std::make_pair(values.data() + payload_offsets[i],
+                              values.data() + payload_offsets[i+1]);
+    }
+
+    /// the payload of node id i, the first of its run if duplicates are collapsed
+    const T& value(const uint64_t& i) const {
+        return values[collapse_duplicates ? payload_offsets[i] : i];
+    }
+
+    /// the payload of a node, read from the payload column only when asked for
+    const T& value(const interval_node<T>* x) const {
+        return value(node_id(x));
     }
 
     void add(const interval<T>& it) {
-        auto& writer = get_writer();
-        writer.write((char*)&it, sizeof(interval<T>));
+        input.add(it);
+        ++pending;
+    }
+
+    /// force a backend instead of letting index() choose one from the dataset profile, set before index()
+    void set_backend(const stab_backend& b) {
+        requested_backend = b;
+    }
+
+    /// the backend index() chose, or was told to use
+    stab_backend backend(void) const {
+        return chosen_backend;
+    }
+
+    /// what index() measured to choose the backend
+    const dataset_profile& dataset(void) const {
+        return profile;
+    }
+
+    /// sweep the domain in this many chunks in parallel, 1 for the sequential sweep, set before index()
+    /// the default of 0 uses several chunks per thread, the index is the same either way
+    void set_sweep_chunks(const uint64_t& c) {
+        sweep_chunks = c;
+    }
+
+    /// call f with the timing and volume of each build phase as it ends, set before index()
+    /// the build reports nothing unless an observer is set
+    void set_build_observer(const build_observer& f) {
+        observer = f;
+    }
+
+    /// how the mapped structures are paged during the build and afterwards, set before index()
+    void set_mmap_policy(const mmap_policy& p) {
+        policy = p;
+    }
+
+    /// fault in everything a query reads, so the first queries after start-up do not wait on the disk
+    void prewarm(void) {
+        prewarm_vector(stop);
+        prewarm_vector(stop_run_starts);
+        prewarm_vector(stop_run_nodes);
+        prewarm_vector(reach);
+        prewarm_vector(a);
+        prewarm_vector(values);
+        prewarm_vector(payload_offsets);
+    }
+
+    /// declare that intervals are added in sorted order (start ascending, end descending),
+    /// so index() skips the sort and throws if the input turns out otherwise
+    /// sorted input is detected and left unsorted anyway, declaring it makes disorder an error
+    void set_sorted_input(const bool& s) {
+        sorted = s;
     }
 
     void index(void) {
         preprocessing();
     }
 
+    /// index the union of two indexed sets without sorting from scratch
+    /// the sorted node arrays are merged as they stream into our interval file,
+    /// so we must be fresh: nothing added and not yet indexed
+    void merge(const faststabbing& x, const faststabbing& y) {
+        if (indexed || pending) {
+            throw std::logic_error(filename + ": merge needs an empty index, this one "
+                                   + (indexed ? "is already indexed" : "already holds added intervals"));
+        }
+        uint64_t i = 0, j = 0;
+        while (i < x.n || j < y.n) {
+            // ties take from x first
+            bool from_x = j == y.n || i < x.n && !(y.a[j] < x.a[i]);
+            const faststabbing& from = from_x ? x : y;
+            const interval_node<T>& node = from_x ? x.a[i++] : y.a[j++];
+            auto run = from.payloads(&node);
+            for (auto v = run.first; v != run.second; ++v) {
+                add(interval<T>(node.l, node.r, *v));
+            }
+        }
+        bool was_sorted = sorted;
+        sorted = true;
+        preprocessing();
+        sorted = was_sorted;
+    }
+
+    /// the nodes ordered by end point (ties in start order), built on first use
+    const array<interval_node<T>*>& end_order(void) {
+        std::call_once(ends_built, [this](void) { build_end_order(); });
+        return ends;
+    }
+
+    /// the number of input intervals covering every covered position as runs in increasing order,
+    /// swept over the sorted start and end points in parallel domain chunks
+    std::vector<coverage_run> coverage(void) {
+        const auto& e = end_order();
+        std::vector<std::vector<coverage_run>> chunk_runs(get_thread_count());
+        uint64_t chunk_size = bigN / chunk_runs.size() + 1;
+#pragma omp parallel for schedule(static, 1)
+        for (uint64_t c = 0; c < chunk_runs.size(); ++c) {
+            uint64_t begin = 1 + c * chunk_size;
+            uint64_t last = std::min(bigN, begin + chunk_size - 1);
+            if (begin > last) continue;
+            auto& runs = chunk_runs[c];
+            // the depth at the start of the chunk, and the first events after it
+            uint64_t depth = 0;
+            for (auto& x : query(begin)) depth += multiplicity(x);
+            uint64_t s = std::upper_bound(a.begin(), a.end(), begin,
+                                          [](const uint64_t& p, const interval_node<T>& x) {
+                                              return p < x.l; }) - a.begin();
+            uint64_t t = std::lower_bound(e.begin(), e.end(), begin,
+                                          [](const interval_node<T>* x, const uint64_t& p) {
+                                              return x->r < p; }) - e.begin();
+            uint64_t at = begin;
+            while (at <= last) {
+                // the next position where the depth changes
+                uint64_t next = last + 1;
+                if (s < n) next = std::min(next, a[s].l);
+                if (t < n) next = std::min(next, e[t]->r + 1);
+                if (next > at && depth > 0) {
+                    runs.push_back(coverage_run());
+                    runs.back().l = at;
+                    runs.back().r = next - 1;
+                    runs.back().depth = depth;
+                }
+                if (next > last) break;
+                for ( ; s < n && a[s].l == next; ++s) depth += multiplicity(&a[s]);
+                for ( ; t < n && e[t]->r + 1 == next; ++t) depth -= multiplicity(e[t]);
+                at = next;
+            }
+        }
+        // join the chunks, merging runs split at chunk boundaries
+        std::vector<coverage_run> runs;
+        for (auto& chunk : chunk_runs) {
+            for (auto& run : chunk) {
+                if (!runs.empty() && runs.back().r + 1 == run.l && runs.back().depth == run.depth) {
+                    runs.back().r = run.r;
+                } else {
+                    runs.push_back(run);
+                }
+            }
+            std::vector<coverage_run>().swap(chunk);
+        }
+        return runs;
+    }
+
+    /// call f(from, to, x) for each run of positions in [1,bigN] sharing the stop entry x,
+    /// read from whichever form stop is kept in, nothing without a forest
+    template <typename F>
+    void for_each_stop_run(const F& f) const {
+        if (stop.empty()) {
+            for (uint64_t k = 0; k < stop_run_starts.size(); ++k) {
+                uint64_t to = k + 1 < stop_run_starts.size() ? stop_run_starts[k+1] - 1 : bigN;
+                f(stop_run_starts[k], to, stop_run_nodes[k]);
+            }
+            return;
+        }
+        uint64_t from = 1;
+        for (uint64_t q = 2; q <= bigN + 1; ++q) {
+            if (q > bigN || stop[q] != stop[from]) {
+                f(from, q - 1, stop[from]);
+                from = q;
+            }
+        }
+    }
+
+    /// the bytes of each structure, the peak the build needed, and the shape of the forest
+    /// the shape is measured here in O(n + bigN), so this is not free on large indexes
+    index_stats stats(void) const {
+        index_stats st;
+        st.backend = backend_name(chosen_backend);
+        st.records = n_records;
+        st.nodes = n;
+        st.domain = bigN;
+        for (uint64_t x = bigN; x; x >>= 1) ++st.coordinate_bits;
+        st.node_bytes = bytes(a);
+        st.stop_bytes = bytes(stop) + bytes(stop_run_starts) + bytes(stop_run_nodes);
+        st.value_bytes = bytes(values);
+        st.payload_offset_bytes = bytes(payload_offsets);
+        st.on_demand_bytes = bytes(ends) + bytes(reach) + bytes(categories);
+        st.total_bytes = st.node_bytes + st.stop_bytes + st.value_bytes
+            + st.payload_offset_bytes + st.on_demand_bytes;
+        st.interval_bytes = build_interval_bytes;
+        st.eventlist_bytes = build_eventlist_bytes;
+        st.eventlist_layout_bytes = build_eventlist_layout_bytes;
+        st.sweep_list_bytes = build_sweep_peak * 3 * sizeof(void*);
+        st.peak_build_bytes = build_peak_bytes;
+        if (n == 0) return st;
+        auto log2_bucket = [](std::vector<uint64_t>& h, const uint64_t& x) {
+            uint64_t k = 63 - __builtin_clzll(x);
+            if (h.size() <= k) h.resize(k+1, 0);
+            ++h[k];
+        };
+        // parents precede their children, and only group heads have one
+        bool forest = chosen_backend != BACKEND_SORTED;
+        std::vector<uint64_t> depth(forest ? n : 0, 0);
+        uint64_t chain = 0;
+        double covered = 0;
+        for (uint64_t i = 0; i < n; ++i) {
+            covered += a[i].r - a[i].l + 1;
+            if (i > 0 && a[i-1].l == a[i].l) {
+                if (forest) depth[i] = depth[i-1]; // reached through smaller from its group
+                ++chain;
+                continue;
+            }
+            if (chain) log2_bucket(st.chain_histogram, chain);
+            chain = 1;
+            if (!forest) continue;
+            depth[i] = a[i].parent == &dummy ? 0 : depth[node_id(a[i].parent)] + 1;
+            if (st.depth_histogram.size() <= depth[i]) st.depth_histogram.resize(depth[i]+1, 0);
+            ++st.depth_histogram[depth[i]];
+        }
+        log2_bucket(st.chain_histogram, chain);
+        // runs of equal stop entries, and the path each position starts from
+        double path = 0;
+        for_each_stop_run([&](const uint64_t& from, const uint64_t& to, const interval_node<T>* x) {
+                log2_bucket(st.stop_run_histogram, to - from + 1);
+                ++st.stop_runs;
+                if (x) path += (double)(to - from + 1) * (depth[node_id(x)] + 1);
+            });
+        st.mean_path = bigN ? path / bigN : 0;
+        st.mean_stabbed = bigN ? covered / bigN : 0;
+        st.expected_cost = forest ? st.mean_path + 2 * st.mean_stabbed
+            : st.mean_stabbed + profile.scan_estimate;
+        return st;
+    }
+
+    /// a cursor sweeping the index in increasing query order
+    sweep_cursor<T, Storage> cursor(void) {
+        return sweep_cursor<T, Storage>(*this);
+    }
+
+    /// call f(x) for every node stabbed at q, in query order, without collecting them
+    template <typename F>
+    void for_each_stabbed(const uint64_t& q, const F& f) {
+        switch (chosen_backend) {
+        case BACKEND_FULL_STOP: stab_forest<T>(stop.data(), bigN, q, f); break;
+        case BACKEND_STOP_RUNS: stab_from<T>(stop_at(q), q, f); break;
+        default: scan_sorted(q, f);
+        }
+    }
+
     std::vector<interval_node<T>*> query(const uint64_t& q) {
-        assert(q >= 1 && q <= bigN+1);
         std::vector<interval_node<T>*> output;
-        if (stop[q] == nullptr) return output; // no stabbed intervals
+        for_each_stabbed(q, [&output](interval_node<T>* x) { output.push_back(x); });
+        //assert(verify(output,q) == 0);
+        return output;
+    }
+
+    /// the nodes stabbed at q for which pred(x) holds, in query order
+    /// the predicate runs inside the traversal, so rejected nodes are never copied out
+    template <typename Pred>
+    std::vector<interval_node<T>*> query_if(const uint64_t& q, const Pred& pred) {
+        std::vector<interval_node<T>*> output;
+        for_each_stabbed(q, [&output, &pred](interval_node<T>* x) {
+                if (pred(x)) output.push_back(x);
+            });
+        return output;
+    }
+
+    /// tag every node with one of count categories, cat(x) < count, for query_category()
+    /// one bitmap of n bits per category, so a category test never reads the payload column
+    template <typename Categorize>
+    void build_categories(const uint64_t& count, const Categorize& cat) {
+        category_count = count;
+        category_words = (n + 63) / 64;
+        categories.allocate(categories_filename(), category_count * category_words);
+        for (auto& w : categories) { w = 0; }
+#pragma omp parallel for
+        for (uint64_t w = 0; w < category_words; ++w) {
+            for (uint64_t i = w * 64; i < std::min(n, (w+1) * 64); ++i) {
+                uint64_t c = cat(&a[i]);
+                assert(c < category_count);
+                categories[c * category_words + w] |= (uint64_t)1 << (i % 64);
+            }
+        }
+    }
+
+    /// whether a node was put in category c by build_categories()
+    bool in_category(const interval_node<T>* x, const uint64_t& c) const {
+        uint64_t i = node_id(x);
+        return (categories[c * category_words + i / 64] >> (i % 64)) & 1;
+    }
+
+    /// the nodes stabbed at q that are in category c, in query order
+    std::vector<interval_node<T>*> query_category(const uint64_t& q, const uint64_t& c) {
+        if (c >= category_count) return std::vector<interval_node<T>*>();
+        return query_if(q, [this, &c](const interval_node<T>* x) { return in_category(x, c); });
+    }
+
+    /// all intervals overlapping [b,e]: those stabbed at b followed by those starting in (b,e]
+    std::vector<interval_node<T>*> query(const uint64_t& b, const uint64_t& e) {
+        std::vector<interval_node<T>*> output = query(b);
+        auto it = std::upper_bound(a.begin(), a.end(), b,
+                                   [](const uint64_t& p, const interval_node<T>& x) {
+                                       return p < x.l; });
+        for ( ; it != a.end() && it->l <= e; ++it) {
+            output.push_back(&*it);
+        }
+        return output;
+    }
+
+    /// all intervals covering the whole of [b,e], in query order
+    /// this is the stabbing traversal at b pruned wherever r < e, which is safe because everything
+    /// the traversal reaches from a node ends no later than it, so the cost is the output plus the
+    /// nodes ending before e on the path up from stop[b]
+    std::vector<interval_node<T>*> enclosing(const uint64_t& b, const uint64_t& e) {
+        std::vector<interval_node<T>*> output;
+        if (b > e || e > bigN) return output;
+        if (chosen_backend == BACKEND_SORTED) {
+            return query_if(b, [&e](const interval_node<T>* x) { return x->r >= e; });
+        }
         interval_node<T>* i;
         interval_node<T>* temp;
         std::deque<interval_node<T>*> process;
-        for (temp = stop[q]; temp->parent != nullptr; temp = temp->parent) {
-            process.push_front(temp);
+        for (temp = stop_at(b); temp != nullptr && temp->parent != nullptr; temp = temp->parent) {
+            if (temp->r >= e) process.push_front(temp);
         }
-
-        // traverse
         while (!process.empty()) {
             i = process.back();
             process.pop_back();
-            //process.pop_back();
             output.push_back(i);
-		
-            temp = i->smaller;
-            while (temp != nullptr) {
-                if (q > temp->r) break;
+            for (temp = i->smaller; temp != nullptr && temp->r >= e; temp = temp->smaller) {
                 output.push_back(temp);
-//#ifdef INTERVALSTAB_DEBUG
-//			cout << "\tSmaller " << (*temp);
-//#endif
-                temp = temp->smaller;
             }
-
-            // go along rightmost path of pa
-            temp = i->leftsibling;
-            while (temp) {
-                if (temp->r < q) break;
+            for (temp = i->leftsibling; temp != nullptr && temp->r >= e; temp = temp->rightchild) {
                 process.push_back(temp);
-                temp = temp->rightchild;
             }
         }
-        //assert(verify(output,q) == 0);
         return output;
     }
+
+    /// all intervals lying inside [b,e], in start order
+    /// they are the nodes starting in [b,e] less those ending after e, or the nodes ending in [b,e]
+    /// less those starting before b, so we scan whichever range is shorter, which costs
+    /// O(log n + output + min(intervals stabbing e from inside, intervals stabbing b from outside))
+    std::vector<interval_node<T>*> contained_in(const uint64_t& b, const uint64_t& e) {
+        std::vector<interval_node<T>*> output;
+        if (b > e) return output;
+        auto first = std::lower_bound(a.begin(), a.end(), b,
+                                      [](const interval_node<T>& x, const uint64_t& p) {
+                                          return x.l < p; });
+        auto last = std::upper_bound(first, a.end(), e,
+                                     [](const uint64_t& p, const interval_node<T>& x) {
+                                         return p < x.l; });
+        const auto& ends = end_order();
+        auto first_end = std::lower_bound(ends.begin(), ends.end(), b,
+                                          [](const interval_node<T>* x, const uint64_t& p) {
+                                              return x->r < p; });
+        auto last_end = std::upper_bound(first_end, ends.end(), e,
+                                         [](const uint64_t& p, const interval_node<T>* x) {
+                                             return p < x->r; });
+        if (last - first <= last_end - first_end) {
+            for (auto it = first; it != last; ++it) {
+                if (it->r <= e) output.push_back(&*it);
+            }
+        } else {
+            for (auto it = first_end; it != last_end; ++it) {
+                if ((*it)->l >= b) output.push_back(*it);
+            }
+            // nodes sit in start order, so their addresses give it back
+            std::sort(output.begin(), output.end());
+        }
+        return output;
+    }
+
+    /// the interval ending closest before q, or nullptr if none ends before it
+    /// the end order is built on first use, after which this is one binary search
+    interval_node<T>* nearest_left(const uint64_t& q) {
+        const auto& e = end_order();
+        auto it = std::lower_bound(e.begin(), e.end(), q,
+                                   [](const interval_node<T>* x, const uint64_t& p) {
+                                       return x->r < p; });
+        return it == e.begin() ? nullptr : *(it - 1);
+    }
+
+    /// the interval starting closest after q, or nullptr if none starts after it
+    interval_node<T>* nearest_right(const uint64_t& q) {
+        auto it = std::upper_bound(a.begin(), a.end(), q,
+                                   [](const uint64_t& p, const interval_node<T>& x) {
+                                       return p < x.l; });
+        return it == a.end() ? nullptr : &*it;
+    }
+
+    /// up to k intervals by distance from q: those stabbed at q in query order, then the
+    /// nearest ones to either side, closer first and the left one first at equal distance
+    std::vector<interval_node<T>*> k_nearest(const uint64_t& q, const uint64_t& k) {
+        std::vector<interval_node<T>*> output = query(q);
+        if (output.size() >= k) {
+            output.resize(k);
+            return output;
+        }
+        // walk outward through the end order to the left and the start order to the right
+        const auto& e = end_order();
+        uint64_t left = std::lower_bound(e.begin(), e.end(), q,
+                                         [](const interval_node<T>* x, const uint64_t& p) {
+                                             return x->r < p; }) - e.begin();
+        uint64_t right = std::upper_bound(a.begin(), a.end(), q,
+                                          [](const uint64_t& p, const interval_node<T>& x) {
+                                              return p < x.l; }) - a.begin();
+        while (output.size() < k && (left > 0 || right < n)) {
+            bool take_left = left > 0
+                && (right == n || q - e[left-1]->r <= a[right].l - q);
+            output.push_back(take_left ? e[--left] : &a[right++]);
+        }
+        return output;
+    }
+
+    /// the number of nodes stabbed at q, in O(log n) from the start and end orders
+    uint64_t depth(const uint64_t& q) {
+        const auto& e = end_order();
+        uint64_t started = std::upper_bound(a.begin(), a.end(), q,
+                                            [](const uint64_t& p, const interval_node<T>& x) {
+                                                return p < x.l; }) - a.begin();
+        uint64_t ended = std::lower_bound(e.begin(), e.end(), q,
+                                          [](const interval_node<T>* x, const uint64_t& p) {
+                                              return x->r < p; }) - e.begin();
+        return started - ended;
+    }
+
+    /// k distinct nodes drawn uniformly from those stabbed at q, or all of them if there are fewer
+    /// every stabbed node lies in the window of start order between the first node reaching q and
+    /// the last node starting by q, so while the window is dense in stabbed nodes we draw from it
+    /// and reject misses, which is O(k log n), and otherwise enumerate and partially shuffle
+    template <typename Rng>
+    std::vector<interval_node<T>*> sample(const uint64_t& q, const uint64_t& k, Rng& rng) {
+        std::vector<interval_node<T>*> output;
+        uint64_t d = depth(q);
+        if (d == 0 || k == 0) return output;
+        std::call_once(reach_built, [this](void) { build_reach(); });
+        uint64_t begin = std::lower_bound(reach.begin(), reach.end(), q) - reach.begin();
+        uint64_t end = std::upper_bound(a.begin(), a.end(), q,
+                                        [](const uint64_t& p, const interval_node<T>& x) {
+                                            return p < x.l; }) - a.begin();
+        uint64_t window = end - begin;
+        if (2*k <= d && window <= 4*d) {
+            // expected draws are at most 2 * 4 per sample
+            std::unordered_set<interval_node<T>*> seen;
+            std::uniform_int_distribution<uint64_t> pick(begin, end-1);
+            while (output.size() < k) {
+                interval_node<T>* x = &a[pick(rng)];
+                if (x->r >= q && seen.insert(x).second) output.push_back(x);
+            }
+        } else {
+            output = query(q);
+            uint64_t m = std::min(k, (uint64_t)output.size());
+            for (uint64_t i = 0; i < m; ++i) {
+                std::uniform_int_distribution<uint64_t> pick(i, output.size()-1);
+                std::swap(output[i], output[pick(rng)]);
+            }
+            output.resize(m);
+        }
+        return output;
+    }
+
+    /// the ids of the nodes stabbed at q in query order, to look up in value() or columns of the caller's own
+    std::vector<uint64_t> query_ids(const uint64_t& q) {
+        std::vector<uint64_t> ids;
+        for (auto& x : query(q)) ids.push_back(node_id(x));
+        return ids;
+    }
+};
+
+// incremental stabbing over monotonically increasing query points
+// each node is entered and exited at most once, so a scan over every
+// position in the domain costs O(n + bigN) instead of O(sum of outputs)
+template <typename T, typename Storage>
+class sweep_cursor {
+private:
+    faststabbing<T, Storage>& db;
+    const typename Storage::template array<interval_node<T>*>& ends;
+    uint64_t next_start = 0; // next node in start order
+    uint64_t next_end = 0; // next node in end order
+    uint64_t pos = 0;
+    std::vector<interval_node<T>*> active;
+    std::unordered_map<interval_node<T>*, uint64_t> slot; // position in active
+    std::vector<interval_node<T>*> in;
+    std::vector<interval_node<T>*> out;
+
+public:
+    sweep_cursor(faststabbing<T, Storage>& index)
+        : db(index), ends(index.end_order()) { }
+
+    /// move to q, which must not be before the current position
+    void advance(const uint64_t& q) {
+        assert(q >= pos);
+        pos = q;
+        in.clear();
+        out.clear();
+        // intervals starting at or before q enter unless they also ended before it
+        while (next_start < db.n && db.a[next_start].l <= q) {
+            interval_node<T>* x = &db.a[next_start++];
+            if (x->r >= q) {
+                slot[x] = active.size();
+                active.push_back(x);
+                in.push_back(x);
+            }
+        }
+        // intervals ending before q exit if they were ever entered
+        while (next_end < db.n && ends[next_end]->r < q) {
+            interval_node<T>* x = ends[next_end++];
+            auto f = slot.find(x);
+            if (f == slot.end()) continue;
+            uint64_t i = f->second;
+            slot.erase(f);
+            if (i != active.size()-1) {
+                active[i] = active.back();
+                slot[active[i]] = i;
+            }
+            active.pop_back();
+            out.push_back(x);
+        }
+    }
+
+    /// the position of the last advance
+    uint64_t position(void) const {
+        return pos;
+    }
+
+    /// the nodes stabbed at the current position, in no particular order
+    const std::vector<interval_node<T>*>& stabbed(void) const {
+        return active;
+    }
+
+    /// the intervals that became stabbed during the last advance
+    const std::vector<interval_node<T>*>& entered(void) const {
+        return in;
+    }
+
+    /// the intervals that stopped being stabbed during the last advance
+    const std::vector<interval_node<T>*>& exited(void) const {
+        return out;
+    }
 };
 
 
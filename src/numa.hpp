@@ -0,0 +1,307 @@
+/************************************************************
+Copyright (C) 2009 Jens M. Schmidt
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+or 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+************************************************************/
+
+#pragma once
+
+// placing the query structures of an index across NUMA nodes
+//
+// the node and stop arrays are first touched by whichever threads ran the
+// build, so on a multi-socket machine most queries hop through remote memory.
+// a numa_index keeps copies of just those two arrays, with every pointer
+// relocated into the copy: either one copy per node, each built by a thread
+// pinned to that node so its pages are local, or one copy whose pages are
+// interleaved over all nodes. payloads stay in the index, read by node id.
+// batch queries run on workers pinned to each node, querying its local copy.
+//
+// the topology is read from sysfs and pages are placed with the mbind system
+// call directly, so there is no dependency on libnuma. without NUMA support
+// everything degrades to a single node and plain copies.
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "mmintervalstab.hpp"
+
+namespace intervalstab {
+
+// mbind modes and flags, from linux/mempolicy.h
+const int numa_mpol_interleave = 3;
+const unsigned numa_mpol_mf_move = 1 << 1;
+
+// a NUMA node and the cpus attached to it
+struct numa_node {
+    int id = 0;
+    std::vector<int> cpus;
+};
+
+// parse a sysfs list like "0-3,8,10-11"
+inline std::vector<int> parse_cpu_list(const std::string& list) {
+    std::vector<int> ids;
+    std::stringstream ss(list);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+        if (range.empty() || range == "\n") continue;
+        size_t dash = range.find('-');
+        int first = std::stoi(range.substr(0, dash));
+        int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+        for (int i = first; i <= last; ++i) ids.push_back(i);
+    }
+    return ids;
+}
+
+/// the nodes with cpus, or one node holding every cpu if the system reports none
+inline std::vector<numa_node> numa_topology(void) {
+    std::vector<numa_node> nodes;
+    std::ifstream online("/sys/devices/system/node/online");
+    std::string list;
+    if (online && std::getline(online, list)) {
+        for (auto& id : parse_cpu_list(list)) {
+            std::ifstream cpulist("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist");
+            std::string cpus;
+            if (!cpulist || !std::getline(cpulist, cpus)) continue;
+            numa_node node;
+            node.id = id;
+            node.cpus = parse_cpu_list(cpus);
+            if (!node.cpus.empty()) nodes.push_back(node); // memory-only nodes run no workers
+        }
+    }
+    if (nodes.empty()) {
+        nodes.push_back(numa_node());
+        for (int i = 0; i < (int)std::max(1u, std::thread::hardware_concurrency()); ++i) {
+            nodes.back().cpus.push_back(i);
+        }
+    }
+    return nodes;
+}
+
+/// restrict the calling thread to the given cpus, false if the system refused
+inline bool pin_to_cpus(const std::vector<int>& cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto& c : cpus) if (c < CPU_SETSIZE) CPU_SET(c, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+/// spread the pages of a range round robin over the given nodes, moving those already touched
+/// false if the kernel has no NUMA support or refused, in which case the pages stay where they are
+inline bool interleave_range(void* p, const uint64_t& bytes, const std::vector<numa_node>& nodes) {
+    if (p == nullptr || bytes == 0) return true;
+    const size_t word_bits = 8 * sizeof(unsigned long);
+    int max_id = 0;
+    for (auto& node : nodes) max_id = std::max(max_id, node.id);
+    std::vector<unsigned long> mask(max_id / word_bits + 1, 0);
+    for (auto& node : nodes) mask[node.id / word_bits] |= 1UL << (node.id % word_bits);
+    uint64_t page = sysconf(_SC_PAGESIZE);
+    uint64_t begin = (uint64_t)p & ~(page - 1);
+    uint64_t end = (uint64_t)p + bytes;
+    return syscall(SYS_mbind, begin, end - begin, numa_mpol_interleave,
+                   mask.data(), mask.size() * word_bits + 1, numa_mpol_mf_move) == 0;
+}
+
+// how the query structures are placed
+enum numa_placement {
+    NUMA_FIRST_TOUCH, // leave them where the build put them
+    NUMA_INTERLEAVE,  // one copy with pages spread over every node
+    NUMA_REPLICATE    // one copy local to each node
+};
+
+inline numa_placement parse_numa_placement(const std::string& name) {
+    if (name == "first-touch") return NUMA_FIRST_TOUCH;
+    if (name == "interleave") return NUMA_INTERLEAVE;
+    if (name == "replicate") return NUMA_REPLICATE;
+    throw std::invalid_argument("unknown NUMA placement " + name + ", expected first-touch, interleave or replicate");
+}
+
+// a copy of the node and stop arrays of an index, pointers relocated into it
+template <typename T>
+struct forest_copy {
+    anonymous_storage::array<interval_node<T>> a;
+    anonymous_storage::array<interval_node<T>*> stop;
+};
+
+// how long the workers of one node took over their share of a batch
+struct numa_batch_timing {
+    int node = 0;
+    uint64_t workers = 0;
+    uint64_t queries = 0;
+    double seconds = 0;
+};
+
+template <typename T, typename Storage = mmap_storage>
+class numa_index {
+private:
+    faststabbing<T, Storage>& db;
+    std::vector<numa_node> nodes;
+    numa_placement placement;
+    std::vector<std::unique_ptr<forest_copy<T>>> copies; // one per node, or a single interleaved one
+
+    // allocate and fill a copy on the calling thread, which decides where its pages land
+    void copy_forest(forest_copy<T>& c) {
+        interval_node<T>* from = db.a.data();
+        c.a.allocate(std::string(), db.n);
+        c.stop.allocate(std::string(), db.stop.size());
+        interval_node<T>* to = c.a.data();
+        // roots hang off the index's dummy node, which the copy shares since traversal only reads it
+        auto relocate = [&](interval_node<T>* p) {
+            return p == nullptr || p == &db.dummy ? p : to + (p - from); };
+        for (uint64_t i = 0; i < db.n; ++i) {
+            auto& x = db.a[i];
+            auto& y = c.a[i];
+            y.l = x.l;
+            y.r = x.r;
+            y.leftsibling = relocate(x.leftsibling);
+            y.rightchild = relocate(x.rightchild);
+            y.parent = relocate(x.parent);
+            y.smaller = relocate(x.smaller);
+        }
+        for (uint64_t i = 0; i < db.stop.size(); ++i) {
+            c.stop[i] = relocate(db.stop[i]);
+        }
+    }
+
+    interval_node<T>* const* stop_for(const uint64_t& k) {
+        switch (placement) {
+        case NUMA_INTERLEAVE: return copies[0]->stop.data();
+        case NUMA_REPLICATE: return copies[k]->stop.data();
+        default: return db.stop.data();
+        }
+    }
+
+public:
+    /// place the query structures of an indexed db over the given nodes
+    /// copies are made of the stop array, so they need the full-stop backend
+    numa_index(faststabbing<T, Storage>& d, const numa_placement& p,
+               const std::vector<numa_node>& topology = numa_topology())
+        : db(d), nodes(topology), placement(p) {
+        if (placement != NUMA_FIRST_TOUCH && db.backend() != BACKEND_FULL_STOP) {
+            throw std::invalid_argument(std::string("NUMA copies need the full-stop backend, not ")
+                                        + backend_name(db.backend()));
+        }
+        if (placement == NUMA_INTERLEAVE) {
+            copies.emplace_back(new forest_copy<T>());
+            copy_forest(*copies.back());
+            interleave_range(copies.back()->a.data(), db.n * sizeof(interval_node<T>), nodes);
+            interleave_range(copies.back()->stop.data(), db.stop.size() * sizeof(interval_node<T>*), nodes);
+        } else if (placement == NUMA_REPLICATE) {
+            // each copy is built by a thread pinned to its node, so first touch puts it there
+            copies.resize(nodes.size());
+            std::vector<std::thread> builders;
+            for (uint64_t k = 0; k < nodes.size(); ++k) {
+                builders.emplace_back([this, k](void) {
+                        pin_to_cpus(nodes[k].cpus);
+                        copies[k].reset(new forest_copy<T>());
+                        copy_forest(*copies[k]);
+                    });
+            }
+            for (auto& b : builders) b.join();
+        }
+    }
+
+    uint64_t node_count(void) const {
+        return nodes.size();
+    }
+
+    const std::vector<numa_node>& topology(void) const {
+        return nodes;
+    }
+
+    /// call f(x) for every node stabbed at q, using the structures placed for NUMA node k
+    template <typename F>
+    void for_each_stabbed(const uint64_t& k, const uint64_t& q, const F& f) {
+        if (placement == NUMA_FIRST_TOUCH) {
+            db.for_each_stabbed(q, f);
+        } else {
+            stab_forest<T>(stop_for(k), db.bigN, q, f);
+        }
+    }
+
+    /// the nodes stabbed at q, from the structures placed for NUMA node k
+    std::vector<interval_node<T>*> query(const uint64_t& k, const uint64_t& q) {
+        std::vector<interval_node<T>*> output;
+        for_each_stabbed(k, q, [&output](interval_node<T>* x) { output.push_back(x); });
+        return output;
+    }
+
+    /// the id of a node returned from any copy, to read its payloads from the index
+    uint64_t node_id(const interval_node<T>* x) const {
+        for (auto& c : copies) {
+            if (c && x >= c->a.begin() && x < c->a.end()) return x - c->a.begin();
+        }
+        return db.node_id(x);
+    }
+
+    /// run a batch of queries on workers pinned to every node, each querying its node's structures
+    /// f(i, x) is called concurrently for every node x stabbed by queries[i]
+    /// the batch is cut among the nodes by worker count, workers_per_node = 0 uses every cpu
+    template <typename F>
+    std::vector<numa_batch_timing> batch(const std::vector<uint64_t>& queries, const F& f,
+                                         const uint64_t& workers_per_node = 0) {
+        std::vector<numa_batch_timing> timings(nodes.size());
+        uint64_t total_workers = 0;
+        for (uint64_t k = 0; k < nodes.size(); ++k) {
+            timings[k].node = nodes[k].id;
+            timings[k].workers = workers_per_node ? workers_per_node : nodes[k].cpus.size();
+            total_workers += timings[k].workers;
+        }
+        const uint64_t chunk = 1024;
+        std::vector<uint64_t> first(nodes.size() + 1, 0);
+        std::vector<std::atomic<uint64_t>> next(nodes.size());
+        for (uint64_t k = 0, w = 0; k < nodes.size(); ++k) {
+            w += timings[k].workers;
+            first[k+1] = queries.size() * w / total_workers;
+            next[k] = first[k];
+            timings[k].queries = first[k+1] - first[k];
+        }
+        std::vector<std::vector<double>> worker_seconds(nodes.size());
+        std::vector<std::thread> workers;
+        for (uint64_t k = 0; k < nodes.size(); ++k) {
+            worker_seconds[k].resize(timings[k].workers);
+            for (uint64_t w = 0; w < timings[k].workers; ++w) {
+                workers.emplace_back([&, k, w](void) {
+                        pin_to_cpus(nodes[k].cpus);
+                        auto start = std::chrono::steady_clock::now();
+                        uint64_t i;
+                        while ((i = next[k].fetch_add(chunk)) < first[k+1]) {
+                            for (uint64_t j = i; j < std::min(i + chunk, first[k+1]); ++j) {
+                                for_each_stabbed(k, queries[j], [&f, &j](interval_node<T>* x) { f(j, x); });
+                            }
+                        }
+                        worker_seconds[k][w] = std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - start).count();
+                    });
+            }
+        }
+        for (auto& w : workers) w.join();
+        for (uint64_t k = 0; k < nodes.size(); ++k) {
+            for (auto& s : worker_seconds[k]) timings[k].seconds = std::max(timings[k].seconds, s);
+        }
+        return timings;
+    }
+};
+
+}
@@ -0,0 +1,282 @@
+/************************************************************
+Copyright (C) 2009 Jens M. Schmidt
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+or 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+************************************************************/
+
+// intervalstab-serve: one index shared by many local clients
+//
+// a single thread accepts connections and reads request frames, and a pool
+// of workers takes whatever has queued up in batches, runs each batch in
+// position order so neighbouring queries share pages, then answers every
+// connection in the batch with one write
+
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <csignal>
+#include <poll.h>
+#include "mmintervalstab.hpp"
+#include "input.hpp"
+#include "serve_protocol.hpp"
+#include "args.hxx"
+
+using namespace intervalstab;
+using namespace intervalstab::serve;
+
+namespace {
+
+volatile std::sig_atomic_t stopping = 0;
+
+void stop_serving(int) {
+    stopping = 1;
+}
+
+struct connection {
+    int fd;
+    std::mutex write_lock;
+    std::string pending; // bytes of an incomplete request, touched only by the reader
+    connection(int f) : fd(f) { }
+    ~connection(void) { ::close(fd); }
+};
+
+struct job {
+    std::shared_ptr<connection> conn;
+    request req;
+};
+
+class job_queue {
+private:
+    std::mutex lock;
+    std::condition_variable ready;
+    std::deque<job> jobs;
+    bool closed = false;
+
+public:
+    void push(std::vector<job>& incoming) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            for (auto& j : incoming) jobs.push_back(std::move(j));
+        }
+        incoming.clear();
+        ready.notify_all();
+    }
+
+    // wait for work and take up to max_batch jobs, false once closed and drained
+    bool pop(std::vector<job>& batch, const size_t& max_batch) {
+        std::unique_lock<std::mutex> guard(lock);
+        ready.wait(guard, [this](void) { return closed || !jobs.empty(); });
+        if (jobs.empty()) return false;
+        while (!jobs.empty() && batch.size() < max_batch) {
+            batch.push_back(std::move(jobs.front()));
+            jobs.pop_front();
+        }
+        return true;
+    }
+
+    void close(void) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            closed = true;
+        }
+        ready.notify_all();
+    }
+};
+
+void work(faststabbing<uint64_t>& db, job_queue& queue, const size_t& max_batch) {
+    std::vector<job> batch;
+    std::vector<size_t> order;
+    std::vector<std::string> frames;
+    while (queue.pop(batch, max_batch)) {
+        // answer in position order for locality, reply grouped by connection
+        order.resize(batch.size());
+        frames.resize(batch.size());
+        for (size_t i = 0; i < batch.size(); ++i) order[i] = i;
+        std::sort(order.begin(), order.end(), [&batch](const size_t& x, const size_t& y) {
+                return batch[x].req.begin < batch[y].req.begin; });
+        for (auto& i : order) {
+            const request& req = batch[i].req;
+            response_header header;
+            header.tag = req.tag;
+            std::vector<interval_node<uint64_t>*> found;
+            if (req.kind == POINT) {
+                found = db.query(req.begin);
+            } else if (req.kind == RANGE && req.begin <= req.end) {
+                found = db.query(req.begin, req.end);
+            } else {
+                header.status = BAD_REQUEST;
+            }
+            // one record per input interval, expanding collapsed duplicates
+            header.count = 0;
+            for (auto& x : found) header.count += db.multiplicity(x);
+            std::string& frame = frames[i];
+            frame.resize(sizeof(header) + header.count*sizeof(result));
+            std::memcpy(&frame[0], &header, sizeof(header));
+            result* out = (result*)&frame[sizeof(header)];
+            for (auto& x : found) {
+                auto run = db.payloads(x);
+                for (auto v = run.first; v != run.second; ++v) {
+                    out->l = x->l;
+                    out->r = x->r;
+                    out->value = *v;
+                    ++out;
+                }
+            }
+        }
+        std::stable_sort(order.begin(), order.end(), [&batch](const size_t& x, const size_t& y) {
+                return batch[x].conn.get() < batch[y].conn.get(); });
+        for (size_t i = 0; i < order.size(); ) {
+            connection* conn = batch[order[i]].conn.get();
+            std::string out;
+            for ( ; i < order.size() && batch[order[i]].conn.get() == conn; ++i) {
+                out.append(frames[order[i]]);
+            }
+            // a client that went away just loses its answers
+            std::lock_guard<std::mutex> guard(conn->write_lock);
+            write_all(conn->fd, out.data(), out.size());
+        }
+        batch.clear();
+    }
+}
+
+int listen_unix(const std::string& path) {
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        throw std::runtime_error(std::string("socket: ") + std::strerror(errno));
+    }
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path)-1);
+    ::unlink(path.c_str());
+    if (::bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0 || ::listen(fd, SOMAXCONN) < 0) {
+        throw std::runtime_error(path + ": " + std::strerror(errno));
+    }
+    return fd;
+}
+
+}
+
+int main(int argc, char** argv) {
+
+    args::ArgumentParser parser("serve stabbing queries against one shared index over a unix socket");
+    args::HelpFlag help(parser, "help", "display this help summary", {'h', "help"});
+    args::ValueFlag<std::string> socket_path(parser, "PATH", "listen on this unix domain socket", {'s', "socket"});
+    args::ValueFlag<std::string> input_file(parser, "FILE", "index the intervals in this file (start end [value] per line, 1-based, closed)", {'i', "intervals"});
+    args::Flag bed_input(parser, "bed", "the input is BED (0-based, half-open, value is the record number)", {'B', "bed"});
+    args::Flag collapse(parser, "collapse", "store identical intervals once with a run of payloads", {'u', "collapse-duplicates"});
+    args::ValueFlag<std::string> index_base(parser, "FILE", "base name for the index files", {'T', "index-file"});
+    args::ValueFlag<uint64_t> threads(parser, "N", "number of query workers", {'t', "threads"});
+    args::ValueFlag<uint64_t> batch_size(parser, "N", "take at most this many queued requests per batch", {'b', "batch-size"});
+    args::Flag no_prewarm(parser, "no-prewarm", "do not fault in the index before accepting connections", {"no-prewarm"});
+    args::Flag huge_pages(parser, "huge-pages", "back the index with transparent huge pages where available", {"huge-pages"});
+
+    try {
+        parser.ParseCLI(argc, argv);
+    } catch (args::Help&) {
+        std::cout << parser;
+        return 0;
+    } catch (args::ParseError& e) {
+        std::cerr << e.what() << std::endl;
+        std::cerr << parser;
+        return 1;
+    }
+    if (args::get(socket_path).empty() || args::get(input_file).empty()) {
+        std::cerr << parser;
+        return 1;
+    }
+
+    std::string base = index_base ? args::get(index_base) : args::get(socket_path) + ".index";
+    faststabbing<uint64_t> db(base);
+    db.set_collapse_duplicates(collapse);
+    mmap_policy policy;
+    policy.prewarm = !no_prewarm; // keep cold page faults out of the first answers
+    policy.huge_pages = huge_pages;
+    db.set_mmap_policy(policy);
+    uint64_t count = load_intervals(args::get(input_file), (bool)bed_input, db);
+    db.index();
+    std::cerr << "[intervalstab-serve] indexed " << count << " intervals" << std::endl;
+
+    std::signal(SIGINT, stop_serving);
+    std::signal(SIGTERM, stop_serving);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    int listener = listen_unix(args::get(socket_path));
+    job_queue queue;
+    size_t max_batch = batch_size ? std::max((uint64_t)1, args::get(batch_size)) : 64;
+    size_t worker_count = threads ? args::get(threads) : std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < worker_count; ++i) {
+        workers.emplace_back(work, std::ref(db), std::ref(queue), max_batch);
+    }
+    std::cerr << "[intervalstab-serve] listening on " << args::get(socket_path)
+              << " with " << worker_count << " workers" << std::endl;
+
+    std::vector<std::shared_ptr<connection>> conns;
+    std::vector<pollfd> fds;
+    std::vector<job> incoming;
+    char buf[1 << 16];
+    while (!stopping) {
+        fds.resize(conns.size() + 1);
+        fds[0].fd = listener;
+        fds[0].events = POLLIN;
+        for (size_t i = 0; i < conns.size(); ++i) {
+            fds[i+1].fd = conns[i]->fd;
+            fds[i+1].events = POLLIN;
+        }
+        // wake up now and then to notice signals
+        if (::poll(fds.data(), fds.size(), 200) <= 0) continue;
+        for (size_t i = 0; i < conns.size(); ++i) {
+            if (!fds[i+1].revents) continue;
+            auto& conn = conns[i];
+            ssize_t got = ::read(conn->fd, buf, sizeof(buf));
+            if (got <= 0) {
+                if (got < 0 && errno == EINTR) continue;
+                conn.reset(); // closed once the last pending answer is written
+                continue;
+            }
+            conn->pending.append(buf, got);
+            size_t whole = conn->pending.size() / sizeof(request);
+            for (size_t j = 0; j < whole; ++j) {
+                job next;
+                next.conn = conn;
+                std::memcpy(&next.req, conn->pending.data() + j*sizeof(request), sizeof(request));
+                incoming.push_back(std::move(next));
+            }
+            conn->pending.erase(0, whole*sizeof(request));
+        }
+        conns.erase(std::remove(conns.begin(), conns.end(), nullptr), conns.end());
+        if (!incoming.empty()) {
+            queue.push(incoming);
+        }
+        if (fds[0].revents & POLLIN) {
+            int fd = ::accept(listener, nullptr, nullptr);
+            if (fd >= 0) {
+                conns.push_back(std::make_shared<connection>(fd));
+            }
+        }
+    }
+
+    queue.close();
+    for (auto& w : workers) w.join();
+    ::close(listener);
+    ::unlink(args::get(socket_path).c_str());
+    return 0;
+}
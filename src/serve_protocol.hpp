@@ -0,0 +1,164 @@
+/************************************************************
+Copyright (C) 2009 Jens M. Schmidt
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+or 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+************************************************************/
+
+#pragma once
+
+// wire format of intervalstab-serve, and a blocking client for it
+//
+// clients write fixed-size request frames on a unix stream socket and may
+// pipeline as many as they like; each request gets exactly one response
+// frame carrying the request's tag, but responses to pipelined requests may
+// arrive out of order. all fields are in host byte order.
+
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace intervalstab {
+
+namespace serve {
+
+enum request_kind : uint32_t {
+    POINT = 1, // intervals containing begin
+    RANGE = 2  // intervals overlapping [begin,end]
+};
+
+enum response_status : uint32_t {
+    OK = 0,
+    BAD_REQUEST = 1
+};
+
+struct request {
+    uint32_t kind = POINT;
+    uint32_t tag = 0; // echoed in the response
+    uint64_t begin = 0;
+    uint64_t end = 0;
+};
+
+struct response_header {
+    uint32_t tag = 0;
+    uint32_t status = OK;
+    uint64_t count = 0; // number of result records that follow
+};
+
+struct result {
+    uint64_t l = 0;
+    uint64_t r = 0;
+    uint64_t value = 0;
+};
+
+// write or read exactly len bytes, returning false on a closed or broken socket
+inline bool write_all(int fd, const char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t w = ::send(fd, buf, len, MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return false;
+        buf += w;
+        len -= w;
+    }
+    return true;
+}
+
+inline bool read_all(int fd, char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t r = ::read(fd, buf, len);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        buf += r;
+        len -= r;
+    }
+    return true;
+}
+
+inline int connect_unix(const std::string& path) {
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        throw std::runtime_error(std::string("socket: ") + std::strerror(errno));
+    }
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path)-1);
+    if (::connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        ::close(fd);
+        throw std::runtime_error(path + ": " + std::strerror(errno));
+    }
+    return fd;
+}
+
+// one request at a time over a single connection
+class client {
+private:
+    int fd = -1;
+    uint32_t next_tag = 0;
+
+    std::vector<result> call(const request& req) {
+        if (!write_all(fd, (const char*)&req, sizeof(req))) {
+            throw std::runtime_error("intervalstab-serve connection closed");
+        }
+        response_header header;
+        if (!read_all(fd, (char*)&header, sizeof(header))) {
+            throw std::runtime_error("intervalstab-serve connection closed");
+        }
+        if (header.tag != req.tag || header.status != OK) {
+            throw std::runtime_error("intervalstab-serve rejected request");
+        }
+        std::vector<result> results(header.count);
+        if (!read_all(fd, (char*)results.data(), header.count*sizeof(result))) {
+            throw std::runtime_error("intervalstab-serve connection closed");
+        }
+        return results;
+    }
+
+public:
+    client(const std::string& path) : fd(connect_unix(path)) { }
+
+    ~client(void) {
+        if (fd >= 0) ::close(fd);
+    }
+
+    client(const client&) = delete;
+    client& operator=(const client&) = delete;
+
+    std::vector<result> point(const uint64_t& q) {
+        request req;
+        req.kind = POINT;
+        req.tag = next_tag++;
+        req.begin = q;
+        req.end = q;
+        return call(req);
+    }
+
+    std::vector<result> range(const uint64_t& b, const uint64_t& e) {
+        request req;
+        req.kind = RANGE;
+        req.tag = next_tag++;
+        req.begin = b;
+        req.end = e;
+        return call(req);
+    }
+};
+
+}
+
+}
@@ -0,0 +1,285 @@
+/************************************************************
+Copyright (C) 2009 Jens M. Schmidt
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+or 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+************************************************************/
+
+#pragma once
+
+// where faststabbing keeps its arrays and the intervals added before index()
+//
+// a storage policy provides array<X>, a fixed-size array of default
+// constructed X that is given a name when allocated and freed on release or
+// destruction, and spool<X>, which collects records added from many threads
+// until they are finished into one array
+//
+// mmap_storage backs every array with a file named after the index, so an
+// index can be larger than memory. anonymous_storage keeps everything in
+// anonymous mappings and never touches the filesystem.
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cassert>
+#include <algorithm>
+#include <new>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <omp.h>
+#include "mmappable_vector.h"
+
+namespace intervalstab {
+
+using namespace mmap_allocator_namespace;
+
+template <typename T>
+void fill_file(const char *fname, const uint64_t& count) {
+    std::ofstream out(fname, std::ios_base::binary | std::ios::trunc);
+    T x;
+    for (uint64_t i=0; i<count; i++) {
+        out.write((char*)&x, sizeof(T));
+    }
+    out.close();
+}
+
+inline int get_thread_count(void) {
+    int thread_count = 1;
+#pragma omp parallel
+    {
+#pragma omp master
+        thread_count = omp_get_num_threads();
+    }
+    return thread_count;
+}
+
+// arrays in files mapped shared, removed when released
+struct mmap_storage {
+
+    template <typename X>
+    class array {
+    private:
+        mmappable_vector<X> v;
+        std::string fname;
+        bool mapped = false;
+
+    public:
+        array(void) { }
+        ~array(void) { release(); }
+        array(const array&) = delete;
+        array& operator=(const array&) = delete;
+
+        void allocate(const std::string& f, const uint64_t& count) {
+            release();
+            assert(!f.empty());
+            fname = f;
+            fill_file<X>(fname.c_str(), count);
+            if (count) {
+                v.mmap_file(fname.c_str(), READ_WRITE_SHARED, 0, count);
+                mapped = true;
+            }
+        }
+
+        // take over a file of count records written elsewhere
+        void adopt(const std::string& f, const uint64_t& count) {
+            release();
+            fname = f;
+            if (count) {
+                v.mmap_file(fname.c_str(), READ_WRITE_SHARED, 0, count);
+                mapped = true;
+            }
+        }
+
+        void release(void) {
+            if (mapped) v.munmap_file();
+            mapped = false;
+            if (!fname.empty()) std::remove(fname.c_str());
+            fname.clear();
+        }
+
+        uint64_t size(void) const { return mapped ? v.size() : 0; }
+        bool empty(void) const { return size() == 0; }
+        X* data(void) { return mapped ? &v[0] : nullptr; }
+        const X* data(void) const { return mapped ? &v[0] : nullptr; }
+        X* begin(void) { return data(); }
+        X* end(void) { return data() + size(); }
+        const X* begin(void) const { return data(); }
+        const X* end(void) const { return data() + size(); }
+        X& operator[](const uint64_t& i) { return v[i]; }
+        const X& operator[](const uint64_t& i) const { return v[i]; }
+    };
+
+    // per-thread files, concatenated into one when finished
+    template <typename X>
+    class spool {
+    private:
+        std::string base;
+        std::ofstream writer;
+        std::vector<std::ofstream> writers;
+
+        std::string writer_filename(size_t i) {
+            std::stringstream wf;
+            wf << base << ".tmp_write" << "." << i;
+            return wf.str();
+        }
+
+        std::ifstream::pos_type filesize(const char* filename) {
+            std::ifstream in(filename, std::ifstream::ate | std::ifstream::binary);
+            return in.tellg();
+        }
+
+    public:
+        void open(const std::string& f) {
+            assert(!f.empty());
+            base = f;
+            writers.clear();
+            writers.resize(get_thread_count());
+            for (size_t i = 0; i < writers.size(); ++i) {
+                auto& writer = writers[i];
+                writer.open(writer_filename(i), std::ios::binary | std::ios::app);
+                if (writer.fail()) {
+                    throw std::ios_base::failure(std::strerror(errno));
+                }
+            }
+        }
+
+        void add(const X& x) {
+            writers[omp_get_thread_num()].write((char*)&x, sizeof(X));
+        }
+
+        // move everything added into out, backed by the file f
+        void finish(array<X>& out, const std::string& f) {
+            // check to see if we ran single-threaded
+            uint64_t used_writers = 0;
+            uint64_t writer_that_wrote = 0;
+            for (size_t i = 0; i < writers.size(); ++i) {
+                writers[i].close();
+                if (filesize(writer_filename(i).c_str())) {
+                    ++used_writers;
+                    writer_that_wrote = i;
+                }
+            }
+            if (used_writers == 1) {
+                std::rename(writer_filename(writer_that_wrote).c_str(), f.c_str());
+            } else {
+                // cat the temp writers onto the end of the main file
+                writer.open(f.c_str(), std::ios::binary | std::ios::trunc);
+                if (writer.fail()) {
+                    throw std::ios_base::failure(std::strerror(errno));
+                }
+                for (size_t i = 0; i < writers.size(); ++i) {
+                    std::ifstream if_w(writer_filename(i), std::ios_base::binary);
+                    if (filesize(writer_filename(i).c_str())) writer << if_w.rdbuf();
+                    if_w.close();
+                }
+                writer.close();
+            }
+            for (size_t i = 0; i < writers.size(); ++i) {
+                std::remove(writer_filename(i).c_str());
+            }
+            writers.clear();
+            struct stat stats;
+            if (-1 == stat(f.c_str(), &stats)) {
+                throw std::ios_base::failure(f + ": " + std::strerror(errno));
+            }
+            assert(stats.st_size % sizeof(X) == 0); // must be even records
+            out.adopt(f, stats.st_size / sizeof(X));
+        }
+    };
+};
+
+// arrays in anonymous private mappings, nothing on disk
+struct anonymous_storage {
+
+    template <typename X>
+    class array {
+    private:
+        X* p = nullptr;
+        uint64_t n = 0;
+
+    public:
+        array(void) { }
+        ~array(void) { release(); }
+        array(const array&) = delete;
+        array& operator=(const array&) = delete;
+
+        void allocate(const std::string&, const uint64_t& count) {
+            release();
+            if (count == 0) return;
+            void* m = mmap(nullptr, count*sizeof(X), PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (m == MAP_FAILED) {
+                throw std::bad_alloc();
+            }
+            p = (X*)m;
+            n = count;
+            for (uint64_t i = 0; i < n; ++i) new (p + i) X();
+        }
+
+        void release(void) {
+            for (uint64_t i = 0; i < n; ++i) p[i].~X();
+            if (p) ::munmap(p, n*sizeof(X));
+            p = nullptr;
+            n = 0;
+        }
+
+        uint64_t size(void) const { return n; }
+        bool empty(void) const { return n == 0; }
+        X* data(void) { return p; }
+        const X* data(void) const { return p; }
+        X* begin(void) { return p; }
+        X* end(void) { return p + n; }
+        const X* begin(void) const { return p; }
+        const X* end(void) const { return p + n; }
+        X& operator[](const uint64_t& i) { return p[i]; }
+        const X& operator[](const uint64_t& i) const { return p[i]; }
+    };
+
+    // per-thread vectors, copied into one array when finished
+    template <typename X>
+    class spool {
+    private:
+        std::vector<std::vector<X>> added;
+
+    public:
+        void open(const std::string&) {
+            added.clear();
+            added.resize(get_thread_count());
+        }
+
+        void add(const X& x) {
+            added[omp_get_thread_num()].push_back(x);
+        }
+
+        void finish(array<X>& out, const std::string& f) {
+            uint64_t count = 0;
+            for (auto& v : added) count += v.size();
+            out.allocate(f, count);
+            X* at = out.data();
+            for (auto& v : added) {
+                at = std::copy(v.begin(), v.end(), at);
+                std::vector<X>().swap(v);
+            }
+            added.clear();
+        }
+    };
+};
+
+}
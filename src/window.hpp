@@ -0,0 +1,135 @@
+/************************************************************
+Copyright (C) 2009 Jens M. Schmidt
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+or 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+************************************************************/
+
+#pragma once
+
+// stabbing over a domain that keeps moving forward
+//
+// intervals are appended roughly in start order and cut into segments by
+// start: a new segment opens once a start lies span or more past the first
+// start of the open one. each segment is a static faststabbing over its own
+// coordinates, shifted to begin at 1, so its stop array only covers what its
+// intervals cover. the open segment is rebuilt lazily when a query finds it
+// changed, so an append costs at most one segment's build, and expiring
+// drops whole segments whose intervals all ended. a query visits only the
+// segments whose extent contains the query point.
+
+#include <deque>
+#include <memory>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include "mmintervalstab.hpp"
+
+namespace intervalstab {
+
+template <typename T, typename Storage = anonymous_storage>
+class sliding_window {
+private:
+    struct segment {
+        uint64_t first = 0; // start of the first interval, which decides what else belongs here
+        uint64_t min_l = 0;
+        uint64_t max_r = 0;
+        std::vector<interval<T>> pending; // everything added, kept until sealed
+        std::unique_ptr<faststabbing<T, Storage>> index;
+        bool dirty = true;
+    };
+
+    uint64_t span = 1;
+    std::string base;
+    uint64_t built = 0; // indexes built so far, to name their files
+    uint64_t count = 0;
+    std::deque<segment> segments;
+
+    void build(segment& s) {
+        s.index.reset(new faststabbing<T, Storage>(
+                          base.empty() ? base : base + ".segment." + std::to_string(built++)));
+        // shift to start at 1
+        for (auto& x : s.pending) {
+            s.index->add(interval<T>(x.l - s.min_l + 1, x.r - s.min_l + 1, x.value));
+        }
+        s.index->index();
+        s.dirty = false;
+    }
+
+    void seal(segment& s) {
+        if (s.dirty) build(s);
+        std::vector<interval<T>>().swap(s.pending);
+    }
+
+public:
+    /// span is the width of start positions gathered in one segment
+    /// base names the segment files when Storage keeps them on disk
+    sliding_window(const uint64_t& s, const std::string& b = std::string())
+        : span(std::max((uint64_t)1, s)), base(b) { }
+
+    /// append an interval, opening a new segment if it starts span or more past the open one
+    void add(const interval<T>& x) {
+        if (segments.empty() || x.l >= segments.back().first + span) {
+            if (!segments.empty()) seal(segments.back());
+            segments.emplace_back();
+            segments.back().first = x.l;
+            segments.back().min_l = x.l;
+            segments.back().max_r = x.r;
+        }
+        segment& s = segments.back();
+        s.min_l = std::min(s.min_l, x.l);
+        s.max_r = std::max(s.max_r, x.r);
+        s.pending.push_back(x);
+        s.dirty = true;
+        ++count;
+    }
+
+    /// drop every segment whose intervals all end before the given position
+    /// intervals ending earlier may survive in segments that are still partly live
+    void expire(const uint64_t& before) {
+        auto expired = [&before](const segment& s) { return s.max_r < before; };
+        for (auto& s : segments) {
+            if (expired(s)) count -= s.pending.empty() ? s.index->size() : s.pending.size();
+        }
+        segments.erase(std::remove_if(segments.begin(), segments.end(), expired), segments.end());
+    }
+
+    /// the intervals stabbed at q, in original coordinates, segment by segment
+    std::vector<interval<T>> query(const uint64_t& q) {
+        std::vector<interval<T>> output;
+        for (auto& s : segments) {
+            if (q < s.min_l || q > s.max_r) continue;
+            if (s.dirty) build(s);
+            uint64_t shift = s.min_l - 1;
+            s.index->for_each_stabbed(q - shift, [&](const interval_node<T>* x) {
+                    auto run = s.index->payloads(x);
+                    for (auto v = run.first; v != run.second; ++v) {
+                        output.push_back(interval<T>(x->l + shift, x->r + shift, *v));
+                    }
+                });
+        }
+        return output;
+    }
+
+    /// the number of intervals held
+    uint64_t size(void) const {
+        return count;
+    }
+
+    uint64_t segment_count(void) const {
+        return segments.size();
+    }
+};
+
+}
@@ -0,0 +1,246 @@
+/************************************************************
+Copyright (C) 2009 Jens M. Schmidt
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+or 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+************************************************************/
+
+#pragma once
+
+// synthetic interval sets and query streams for benchmarking, and a binary
+// query trace format so a stream can be recorded once and replayed exactly
+
+#include <vector>
+#include <string>
+#include <random>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+
+namespace intervalstab {
+
+namespace workload {
+
+enum distribution {
+    GAUSSIAN,    // uniform starts, gaussian lengths
+    UNIFORM,     // uniform starts, uniform lengths in [0, 2*mean]
+    EXPONENTIAL, // uniform starts, exponential lengths
+    HOTSPOT,     // starts around zipf-weighted hotspots, gaussian lengths
+    NESTED,      // stacks of nested intervals around uniform centers
+    GENOME,      // clustered starts, lognormal mixture of read and feature lengths
+    SCAN         // for queries: every position in order
+};
+
+inline distribution parse_distribution(const std::string& name) {
+    if (name == "gaussian") return GAUSSIAN;
+    if (name == "uniform") return UNIFORM;
+    if (name == "exponential") return EXPONENTIAL;
+    if (name == "hotspot" || name == "zipf") return HOTSPOT;
+    if (name == "nested") return NESTED;
+    if (name == "genome") return GENOME;
+    if (name == "scan") return SCAN;
+    throw std::invalid_argument("unknown distribution " + name);
+}
+
+struct parameters {
+    uint64_t max_value = 1; // positions are in [1,max_value]
+    double mean = 0; // mean interval length
+    double stdev = 0; // standard deviation of gaussian lengths
+    uint64_t hotspots = 64; // number of hotspots
+    double zipf_s = 1.1; // zipf exponent over the hotspots
+    double spread = 1000; // standard deviation of positions around a hotspot
+    uint64_t hotspot_seed = 0; // places the hotspot centers, so generators given the same one share them
+};
+
+// hotspot centers and their zipf weights, the same for every generator given the
+// same hotspot seed, so queries can be aimed where the intervals pile up
+class hotspot_model {
+private:
+    std::vector<uint64_t> centers;
+    std::vector<double> cdf;
+    std::normal_distribution<> offset;
+
+public:
+    hotspot_model(const parameters& p)
+        : offset(0, p.spread) {
+        std::mt19937_64 gen(p.hotspot_seed);
+        std::uniform_int_distribution<uint64_t> pos(1, p.max_value);
+        double total = 0;
+        for (uint64_t i = 1; i <= std::max((uint64_t)1, p.hotspots); ++i) {
+            centers.push_back(pos(gen));
+            total += 1.0 / std::pow((double)i, p.zipf_s);
+            cdf.push_back(total);
+        }
+        for (auto& c : cdf) c /= total;
+    }
+
+    template <typename Gen>
+    uint64_t operator()(Gen& gen, const uint64_t& max_value) {
+        double u = std::uniform_real_distribution<>(0, 1)(gen);
+        uint64_t h = std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+        int64_t x = (int64_t)centers[std::min(h, (uint64_t)centers.size()-1)]
+            + (int64_t)std::round(offset(gen));
+        return (uint64_t)std::max((int64_t)1, std::min((int64_t)max_value, x));
+    }
+};
+
+// intervals [l,r] with 1 <= l <= r <= max_value
+class interval_generator {
+private:
+    distribution dist;
+    parameters p;
+    std::mt19937 gen;
+    std::uniform_int_distribution<uint64_t> pos;
+    std::normal_distribution<> gaussian;
+    hotspot_model hotspot;
+    // current nested stack
+    uint64_t center = 0;
+    uint64_t level = 0;
+
+    uint64_t lognormal(const double& median, const double& sigma) {
+        return (uint64_t)std::round(std::lognormal_distribution<>(std::log(std::max(1.0, median)), sigma)(gen));
+    }
+
+public:
+    interval_generator(const distribution& d, const parameters& params, const uint64_t& seed)
+        : dist(d), p(params), gen(seed), pos(1, params.max_value),
+          gaussian(params.mean, params.stdev), hotspot(params) { }
+
+    std::pair<uint64_t, uint64_t> operator()(void) {
+        uint64_t l = 0, len = 0;
+        switch (dist) {
+        case UNIFORM:
+            l = pos(gen);
+            len = std::uniform_int_distribution<uint64_t>(0, (uint64_t)std::round(2*p.mean))(gen);
+            break;
+        case EXPONENTIAL:
+            l = pos(gen);
+            len = (uint64_t)std::round(std::exponential_distribution<>(1.0 / std::max(1.0, p.mean))(gen));
+            break;
+        case HOTSPOT:
+            l = hotspot(gen, p.max_value);
+            len = (uint64_t)std::max((int64_t)0, (int64_t)std::round(gaussian(gen)));
+            break;
+        case NESTED: {
+            // each stack is a geometric number of intervals growing around one center
+            if (level == 0 || std::uniform_int_distribution<>(0, 7)(gen) == 0) {
+                center = pos(gen);
+                level = 0;
+            }
+            ++level;
+            uint64_t half = (uint64_t)std::round(level * std::max(1.0, p.mean) / 2);
+            l = center > half ? center - half : 1;
+            len = 2 * half;
+            break;
+        }
+        case GENOME: {
+            // mostly short reads, some gene-sized features and a few very long ones,
+            // half of them piled up on hotspots
+            l = std::uniform_int_distribution<>(0, 1)(gen) ? hotspot(gen, p.max_value) : pos(gen);
+            int kind = std::uniform_int_distribution<>(0, 99)(gen);
+            if (kind < 80) {
+                len = lognormal(p.mean, 0.25);
+            } else if (kind < 97) {
+                len = lognormal(p.mean * 100, 1.0);
+            } else {
+                len = lognormal(p.mean * 1000, 1.5);
+            }
+            break;
+        }
+        case GAUSSIAN:
+        default:
+            // the original test generator, kept stream-compatible for old seeds
+            l = pos(gen);
+            len = (uint64_t)std::max((int64_t)0, (int64_t)std::round(gaussian(gen)));
+            break;
+        }
+        return std::make_pair(l, std::min(l + len, p.max_value));
+    }
+};
+
+// query positions in [1,max_value]
+class query_generator {
+private:
+    distribution dist;
+    parameters p;
+    std::mt19937 gen;
+    std::uniform_int_distribution<uint64_t> pos;
+    hotspot_model hotspot;
+    uint64_t next = 0;
+
+public:
+    query_generator(const distribution& d, const parameters& params, const uint64_t& seed)
+        : dist(d), p(params), gen(seed), pos(1, params.max_value), hotspot(params) { }
+
+    uint64_t operator()(void) {
+        switch (dist) {
+        case SCAN:
+            next = next % p.max_value + 1;
+            return next;
+        case HOTSPOT:
+        case GENOME:
+            return hotspot(gen, p.max_value);
+        default:
+            return pos(gen);
+        }
+    }
+};
+
+// query traces are a small header followed by the raw query positions
+const char query_trace_magic[4] = { 'I', 'S', 'Q', 'T' };
+const uint32_t query_trace_version = 1;
+
+inline void write_query_trace(const std::string& fname, const std::vector<uint64_t>& queries) {
+    std::ofstream out(fname.c_str(), std::ios_base::binary | std::ios::trunc);
+    if (out.fail()) {
+        throw std::ios_base::failure(std::strerror(errno));
+    }
+    uint64_t count = queries.size();
+    out.write(query_trace_magic, sizeof(query_trace_magic));
+    out.write((char*)&query_trace_version, sizeof(query_trace_version));
+    out.write((char*)&count, sizeof(count));
+    out.write((char*)queries.data(), count*sizeof(uint64_t));
+    out.close();
+}
+
+inline std::vector<uint64_t> read_query_trace(const std::string& fname) {
+    std::ifstream in(fname.c_str(), std::ios_base::binary);
+    if (in.fail()) {
+        throw std::ios_base::failure(std::strerror(errno));
+    }
+    char magic[4];
+    uint32_t version = 0;
+    uint64_t count = 0;
+    in.read(magic, sizeof(magic));
+    in.read((char*)&version, sizeof(version));
+    in.read((char*)&count, sizeof(count));
+    if (!in || std::memcmp(magic, query_trace_magic, sizeof(magic)) != 0) {
+        throw std::runtime_error(fname + " is not a query trace");
+    }
+    if (version != query_trace_version) {
+        throw std::runtime_error(fname + " has unsupported query trace version " + std::to_string(version));
+    }
+    std::vector<uint64_t> queries(count);
+    in.read((char*)queries.data(), count*sizeof(uint64_t));
+    if (!in) {
+        throw std::runtime_error(fname + " is truncated");
+    }
+    return queries;
+}
+
+}
+
+}